@@ -0,0 +1,481 @@
+#include "backlogjournal.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <initializer_list>
+#include <iostream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace
+{
+    // file header: magic, format version, number of stats fields
+    constexpr char MAGIC[4] = {'R', 'K', 'B', 'L'};
+    constexpr uint32_t VERSION = 1;
+    constexpr size_t HEADER_SIZE = sizeof(MAGIC) + 2 * sizeof(uint32_t);
+
+    // record: payload size, crc32 of the payload, payload
+    constexpr size_t RECORD_HEADER_SIZE = 2 * sizeof(uint32_t);
+
+    // a rewrite is triggered when the file contains more records than this.
+    constexpr size_t MIN_REWRITE_RECORDS = 1024;
+    constexpr size_t REWRITE_FACTOR = 4;
+
+    enum
+    {
+        ACTION_UPDATE = 0,
+        ACTION_SET,
+        ACTION_DELETE,
+    };
+
+    // writes the buffered data and makes the kernel write it to the disk.
+    bool SyncFile(std::FILE* pFile)
+    {
+        return std::fflush(pFile) == 0 && fsync(fileno(pFile)) == 0;
+    }
+
+    // a renamed file is only durable after its directory entry has been written to the disk.
+    bool SyncDirectory(const std::string& filePath)
+    {
+        size_t slash = filePath.find_last_of('/');
+        std::string directory = slash == std::string::npos ? "." : filePath.substr(0, std::max<size_t>(slash, 1));
+
+        int fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+        if (fd < 0)
+            return false;
+
+        bool synced = fsync(fd) == 0;
+        close(fd);
+        return synced;
+    }
+
+    std::array<uint32_t, 256> MakeCrcTable()
+    {
+        std::array<uint32_t, 256> table{};
+        for (uint32_t i = 0; i < table.size(); i++)
+        {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; bit++)
+            {
+                crc = (crc & 1) ? 0xEDB88320u ^ (crc >> 1) : crc >> 1;
+            }
+            table[i] = crc;
+        }
+        return table;
+    }
+
+    uint32_t Crc32(const char* pData, size_t size)
+    {
+        static const std::array<uint32_t, 256> s_Table = MakeCrcTable();
+
+        uint32_t crc = 0xFFFFFFFFu;
+        for (size_t i = 0; i < size; i++)
+        {
+            crc = s_Table[(crc ^ static_cast<unsigned char>(pData[i])) & 0xFF] ^ (crc >> 8);
+        }
+        return crc ^ 0xFFFFFFFFu;
+    }
+
+    template <typename T>
+    void Write(std::string& buffer, T value)
+    {
+        char bytes[sizeof(T)];
+        std::memcpy(bytes, &value, sizeof(T));
+        buffer.append(bytes, sizeof(T));
+    }
+
+    template <typename T>
+    T Read(const std::string& buffer, size_t offset)
+    {
+        T value;
+        std::memcpy(&value, buffer.data() + offset, sizeof(T));
+        return value;
+    }
+
+    void AppendHeader(std::string& buffer)
+    {
+        buffer.append(MAGIC, sizeof(MAGIC));
+        Write<uint32_t>(buffer, VERSION);
+        Write<uint32_t>(buffer, CPlayerStats::NUM_FIELDS);
+    }
+} // namespace
+
+CBacklogJournal::~CBacklogJournal()
+{
+    if (m_pFile)
+        std::fclose(m_pFile);
+}
+
+void CBacklogJournal::AppendRecord(std::string& buffer, const std::string& action, const std::string& nickname, const CPlayerStats& stats, const std::string& prefix)
+{
+    std::string payload;
+    payload.reserve(1 + 2 * sizeof(uint16_t) + nickname.size() + prefix.size() + CPlayerStats::NUM_FIELDS * sizeof(int32_t));
+
+    if (action == "update")
+        Write<uint8_t>(payload, ACTION_UPDATE);
+    else if (action == "set")
+        Write<uint8_t>(payload, ACTION_SET);
+    else
+        Write<uint8_t>(payload, ACTION_DELETE);
+
+    for (const std::string* pString : {&nickname, &prefix})
+    {
+        uint16_t size = static_cast<uint16_t>(std::min<size_t>(pString->size(), UINT16_MAX));
+        Write<uint16_t>(payload, size);
+        payload.append(*pString, 0, size);
+    }
+
+    for (int field = 0; field < CPlayerStats::NUM_FIELDS; field++)
+    {
+        Write<int32_t>(payload, stats.Get(field));
+    }
+
+    Write<uint32_t>(buffer, static_cast<uint32_t>(payload.size()));
+    Write<uint32_t>(buffer, Crc32(payload.data(), payload.size()));
+    buffer.append(payload);
+}
+
+size_t CBacklogJournal::ParseRecord(const std::string& buffer, size_t offset, std::string& action, std::string& nickname, CPlayerStats& stats, std::string& prefix)
+{
+    if (buffer.size() - offset < RECORD_HEADER_SIZE)
+        return 0;
+
+    size_t payloadSize = Read<uint32_t>(buffer, offset);
+    uint32_t crc = Read<uint32_t>(buffer, offset + sizeof(uint32_t));
+    size_t begin = offset + RECORD_HEADER_SIZE;
+
+    if (buffer.size() - begin < payloadSize || Crc32(buffer.data() + begin, payloadSize) != crc)
+        return 0;
+
+    // the checksum is valid, the sizes might still be inconsistent for records of a different format.
+    size_t end = begin + payloadSize;
+    size_t pos = begin;
+
+    auto readString = [&](std::string& value) {
+        if (end - pos < sizeof(uint16_t))
+            return false;
+        size_t size = Read<uint16_t>(buffer, pos);
+        pos += sizeof(uint16_t);
+        if (end - pos < size)
+            return false;
+        value.assign(buffer, pos, size);
+        pos += size;
+        return true;
+    };
+
+    if (end - pos < 1)
+        return 0;
+
+    switch (Read<uint8_t>(buffer, pos))
+    {
+        case ACTION_UPDATE:
+            action = "update";
+            break;
+        case ACTION_SET:
+            action = "set";
+            break;
+        case ACTION_DELETE:
+            action = "delete";
+            break;
+        default:
+            return 0;
+    }
+    pos += 1;
+
+    if (!readString(nickname) || !readString(prefix))
+        return 0;
+
+    if (end - pos != CPlayerStats::NUM_FIELDS * sizeof(int32_t))
+        return 0;
+
+    for (int field = 0; field < CPlayerStats::NUM_FIELDS; field++)
+    {
+        stats.Get(field) = Read<int32_t>(buffer, pos);
+        pos += sizeof(int32_t);
+    }
+
+    return RECORD_HEADER_SIZE + payloadSize;
+}
+
+void CBacklogJournal::Apply(const std::string& action, const std::string& nickname, const CPlayerStats& stats, const std::string& prefix)
+{
+    auto indexIt = m_Index.find({nickname, prefix});
+    if (indexIt == m_Index.end())
+    {
+        CEntry& entry = m_Entries[m_NextSequence];
+        entry.m_Nickname = nickname;
+        entry.m_Prefix = prefix;
+        m_Index.emplace(std::make_pair(nickname, prefix), m_NextSequence);
+        m_NextSequence++;
+
+        if (action == "delete")
+        {
+            entry.m_Delete = true;
+        }
+        else
+        {
+            entry.m_Action = action;
+            entry.m_Stats = stats;
+        }
+        return;
+    }
+
+    CEntry& entry = m_Entries[indexIt->second];
+    m_MergedRecords++;
+
+    if (action == "delete")
+    {
+        // previous writes do not matter anymore
+        entry.m_Delete = true;
+        entry.m_Action.clear();
+        entry.m_Stats = CPlayerStats();
+    }
+    else if (action == "update" && !entry.m_Action.empty())
+    {
+        // a set stays a set with the new values
+        entry.m_Stats += stats;
+    }
+    else
+    {
+        entry.m_Action = action;
+        entry.m_Stats = stats;
+    }
+}
+
+void CBacklogJournal::Rewrite()
+{
+    if (m_FilePath.empty())
+        return;
+
+    std::string buffer;
+    AppendHeader(buffer);
+
+    size_t records = 0;
+    for (auto& [sequence, entry] : m_Entries)
+    {
+        if (entry.m_Delete)
+        {
+            AppendRecord(buffer, "delete", entry.m_Nickname, CPlayerStats(), entry.m_Prefix);
+            records++;
+        }
+        if (!entry.m_Action.empty())
+        {
+            AppendRecord(buffer, entry.m_Action, entry.m_Nickname, entry.m_Stats, entry.m_Prefix);
+            records++;
+        }
+    }
+
+    // the old file is replaced at once, a crash leaves either the old or the new file behind.
+    // the new file is synced before the rename, otherwise it might be empty after a power loss.
+    std::string tmpPath = m_FilePath + ".tmp";
+    std::FILE* pTmpFile = std::fopen(tmpPath.c_str(), "wb");
+    if (!pTmpFile)
+        throw std::runtime_error("[backlog]: failed to create " + tmpPath);
+
+    bool written = std::fwrite(buffer.data(), 1, buffer.size(), pTmpFile) == buffer.size() && SyncFile(pTmpFile);
+    std::fclose(pTmpFile);
+    if (!written)
+        throw std::runtime_error("[backlog]: failed to write " + tmpPath);
+
+    if (m_pFile)
+    {
+        std::fclose(m_pFile);
+        m_pFile = nullptr;
+    }
+
+    if (std::rename(tmpPath.c_str(), m_FilePath.c_str()) != 0)
+    {
+        // some platforms do not replace existing files
+        std::remove(m_FilePath.c_str());
+        if (std::rename(tmpPath.c_str(), m_FilePath.c_str()) != 0)
+            throw std::runtime_error("[backlog]: failed to replace " + m_FilePath);
+    }
+
+    if (!SyncDirectory(m_FilePath))
+        std::cout << "[backlog]: failed to sync the directory of " << m_FilePath << std::endl;
+
+    m_pFile = std::fopen(m_FilePath.c_str(), "ab");
+    if (!m_pFile)
+        throw std::runtime_error("[backlog]: failed to open " + m_FilePath);
+
+    m_FileBytes = buffer.size();
+    m_FileRecords = records;
+}
+
+void CBacklogJournal::Open(const std::string& filePath)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    std::string buffer;
+    if (std::FILE* pFile = std::fopen(filePath.c_str(), "rb"))
+    {
+        char chunk[4096];
+        size_t size = 0;
+        while ((size = std::fread(chunk, 1, sizeof(chunk), pFile)) > 0)
+        {
+            buffer.append(chunk, size);
+        }
+        std::fclose(pFile);
+    }
+
+    if (!buffer.empty() &&
+        (buffer.size() < HEADER_SIZE || buffer.compare(0, sizeof(MAGIC), MAGIC, sizeof(MAGIC)) != 0 ||
+         Read<uint32_t>(buffer, sizeof(MAGIC)) != VERSION ||
+         Read<uint32_t>(buffer, sizeof(MAGIC) + sizeof(uint32_t)) != CPlayerStats::NUM_FIELDS))
+    {
+        throw std::runtime_error("[backlog]: " + filePath + " is not a backlog journal of this version.");
+    }
+
+    // the actions of the file happened before the ones that are kept in memory.
+    std::map<uint64_t, CEntry> memoryEntries;
+    memoryEntries.swap(m_Entries);
+    m_Index.clear();
+
+    size_t offset = HEADER_SIZE;
+    size_t loaded = 0;
+    while (offset < buffer.size())
+    {
+        std::string action, nickname, prefix;
+        CPlayerStats stats;
+
+        size_t size = ParseRecord(buffer, offset, action, nickname, stats, prefix);
+        if (size == 0)
+            break;
+
+        Apply(action, nickname, stats, prefix);
+        offset += size;
+        loaded++;
+    }
+
+    if (offset < buffer.size())
+        std::cout << "[backlog]: dropped " << buffer.size() - offset << " bytes of incomplete records in " << filePath << std::endl;
+
+    for (auto& [sequence, entry] : memoryEntries)
+    {
+        if (entry.m_Delete)
+            Apply("delete", entry.m_Nickname, CPlayerStats(), entry.m_Prefix);
+        if (!entry.m_Action.empty())
+            Apply(entry.m_Action, entry.m_Nickname, entry.m_Stats, entry.m_Prefix);
+    }
+
+    m_FilePath = filePath;
+    Rewrite();
+
+    if (loaded > 0)
+        std::cout << "[backlog]: loaded " << loaded << " records(" << m_Entries.size() << " entries) from " << filePath << std::endl;
+}
+
+void CBacklogJournal::Add(const std::string& action, const std::string& nickname, const CPlayerStats& stats, const std::string& prefix)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    Apply(action, nickname, stats, prefix);
+
+    if (!m_pFile)
+        return;
+
+    // called by failed tasks, errors are reported but the entry is kept in memory.
+    // the record is synced, the writer has already been told that its write succeeded.
+    std::string record;
+    AppendRecord(record, action, nickname, stats, prefix);
+    if (std::fwrite(record.data(), 1, record.size(), m_pFile) != record.size() || !SyncFile(m_pFile))
+    {
+        std::cout << "[backlog]: failed to append to " << m_FilePath << std::endl;
+        return;
+    }
+
+    m_FileBytes += record.size();
+    m_FileRecords++;
+
+    // a running replay still needs the records of the taken entries.
+    if (!m_Replaying && m_FileRecords > MIN_REWRITE_RECORDS && m_FileRecords > REWRITE_FACTOR * m_Entries.size())
+    {
+        try
+        {
+            Rewrite();
+        }
+        catch (const std::exception& e)
+        {
+            std::cout << e.what() << std::endl;
+        }
+    }
+}
+
+std::vector<CBacklogJournal::CEntry> CBacklogJournal::TakeForReplay()
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    std::vector<CEntry> entries;
+    if (m_Replaying || m_Entries.empty())
+        return entries;
+
+    entries.reserve(m_Entries.size());
+    for (auto& [sequence, entry] : m_Entries)
+    {
+        entry.m_Sequence = sequence;
+        entries.push_back(std::move(entry));
+    }
+
+    m_Entries.clear();
+    m_Index.clear();
+    m_Replaying = true;
+    return entries;
+}
+
+void CBacklogJournal::Restore(const CEntry& entry)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_Entries[entry.m_Sequence] = entry;
+}
+
+void CBacklogJournal::FinishReplay(size_t replayedEntries, double seconds)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    m_Replaying = false;
+    m_ReplayedEntries += replayedEntries;
+    m_ReplayRate = seconds > 0.0 ? replayedEntries / seconds : 0.0;
+
+    // drops the records of the replayed entries
+    try
+    {
+        Rewrite();
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << e.what() << std::endl;
+    }
+}
+
+size_t CBacklogJournal::GetSize()
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_Entries.size();
+}
+
+size_t CBacklogJournal::GetFileBytes()
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_FileBytes;
+}
+
+size_t CBacklogJournal::GetMergedRecords()
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_MergedRecords;
+}
+
+double CBacklogJournal::GetReplayRate()
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_ReplayRate;
+}
+
+size_t CBacklogJournal::GetReplayedEntries()
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_ReplayedEntries;
+}
@@ -0,0 +1,117 @@
+#ifndef BACKLOG_JOURNAL_H
+#define BACKLOG_JOURNAL_H
+
+#include "playerstats.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Write actions that could not be executed, kept until the database is reachable again.
+ * Every action is appended to a journal file as a checksummed record and synced to the disk,
+ * so the backlog survives a crash of the server or the machine. A torn or corrupted record
+ * at the end of the file(crash while writing) is dropped when the journal is opened.
+ *
+ * The actions are compacted in memory: the deltas of repeated updates of a player
+ * are summed up, a set replaces everything before it and a delete drops the writes before it.
+ * The file is rewritten with the compacted actions, when it is opened, when a replay has
+ * finished and when it contains many more records than actions.
+ *
+ * Entries are removed from the file after the whole replay has finished, if the process
+ * is killed during a replay, the replayed entries are replayed again with the next start.
+ */
+class CBacklogJournal
+{
+   public:
+    struct CEntry
+    {
+        std::string m_Nickname;
+        std::string m_Prefix;
+
+        // the player is deleted before the action is executed
+        bool m_Delete{false};
+
+        // "update", "set" or empty
+        std::string m_Action;
+        CPlayerStats m_Stats;
+
+        // position in the backlog
+        uint64_t m_Sequence{0};
+    };
+
+   private:
+    std::mutex m_Mutex;
+
+    // empty -> the backlog is kept in memory only
+    std::string m_FilePath;
+    std::FILE* m_pFile{nullptr};
+
+    // compacted entries in the order of their first action
+    std::map<uint64_t, CEntry> m_Entries;
+    uint64_t m_NextSequence{0};
+
+    // nickname, prefix -> entry that further actions of the player are merged into.
+    // restored entries are not indexed, they stay in front of the newer entries.
+    std::map<std::pair<std::string, std::string>, uint64_t> m_Index;
+
+    size_t m_FileBytes{0};
+    size_t m_FileRecords{0};
+    size_t m_MergedRecords{0};
+
+    bool m_Replaying{false};
+    size_t m_ReplayedEntries{0};
+    double m_ReplayRate{0.0};
+
+    // merges an action into the compacted entries, the mutex needs to be locked.
+    void Apply(const std::string& action, const std::string& nickname, const CPlayerStats& stats, const std::string& prefix);
+
+    static void AppendRecord(std::string& buffer, const std::string& action, const std::string& nickname, const CPlayerStats& stats, const std::string& prefix);
+
+    // parses the record at offset, returns its size or 0 if the record is incomplete or corrupted.
+    static size_t ParseRecord(const std::string& buffer, size_t offset, std::string& action, std::string& nickname, CPlayerStats& stats, std::string& prefix);
+
+    // writes the compacted entries to a new file that replaces the old one, the mutex needs to be locked.
+    void Rewrite();
+
+   public:
+    CBacklogJournal() = default;
+    ~CBacklogJournal();
+
+    CBacklogJournal(const CBacklogJournal&) = delete;
+    CBacklogJournal& operator=(const CBacklogJournal&) = delete;
+
+    // loads the actions of the file, creates it if it does not exist.
+    // the entries that are kept in memory are written to the file.
+    // throws std::runtime_error if the file cannot be written or has been created for different stats.
+    void Open(const std::string& filePath);
+
+    // action is "update", "set" or "delete"
+    // the record is synced to the disk before this returns(fsync).
+    void Add(const std::string& action, const std::string& nickname, const CPlayerStats& stats, const std::string& prefix);
+
+    // removes the entries from memory, in the order they need to be executed.
+    // returns nothing while a replay is running.
+    std::vector<CEntry> TakeForReplay();
+
+    // puts a taken entry that could not be executed back to its position, before all entries
+    // that have been added since. the journal file still contains it until the replay has finished.
+    void Restore(const CEntry& entry);
+
+    // needs to be called after the taken entries have been executed, failed ones need to be restored before.
+    void FinishReplay(size_t replayedEntries, double seconds);
+
+    size_t GetSize();
+    size_t GetFileBytes();
+    size_t GetMergedRecords();
+
+    // entries per second of the last replay
+    double GetReplayRate();
+    size_t GetReplayedEntries();
+};
+
+#endif // BACKLOG_JOURNAL_H
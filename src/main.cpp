@@ -1,10 +1,68 @@
 
 #include "rankingserver.h"
 
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+
+// calls the synchronous update directly, without the worker tasks.
+class CBenchmarkServer : public CSQLiteRankingServer
+{
+   public:
+    CBenchmarkServer(const std::string& filePath, CSQLiteSettings settings) : CSQLiteRankingServer(filePath, {""}, 10000, 1, 0, settings)
+    {
+    }
+
+    using CSQLiteRankingServer::UpdateRankingSync;
+};
+
+// measures the write throughput of CSQLiteRankingServer::UpdateRankingSync with the default settings,
+// where every update is committed on its own, and with group commit.
+static void RunSQLiteBenchmark(int numPlayers, int numUpdates)
+{
+    std::string filePath{"benchmark.db"};
+
+    CPlayerStats delta{1, 1, 1, 1, 1, 1, 1, 1, 1};
+
+    auto measure = [&](const std::string& name, const CSQLiteSettings& settings) {
+        std::remove(filePath.c_str());
+        std::remove((filePath + "-wal").c_str());
+        std::remove((filePath + "-shm").c_str());
+
+        std::unique_ptr<CBenchmarkServer> pServer = std::make_unique<CBenchmarkServer>(filePath, settings);
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < numUpdates; i++)
+        {
+            pServer->UpdateRankingSync("player" + std::to_string(i % numPlayers), delta);
+        }
+
+        // the destructor commits the open group transaction
+        pServer.reset();
+        std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+
+        std::cout << name << "(journal_mode = " << settings.m_JournalMode << ", synchronous = " << settings.m_Synchronous
+                  << ", group commit = " << settings.m_GroupCommitIntervalMs << "ms): " << numUpdates << " updates in "
+                  << seconds.count() << "s -> " << (numUpdates / seconds.count()) << " updates/s" << std::endl;
+    };
+
+    CSQLiteSettings settings;
+    settings.m_NumReaders = 0;
+    measure("UpdateRankingSync", settings);
+
+    settings.m_GroupCommitIntervalMs = 100;
+    measure("UpdateRankingSync", settings);
+}
+
 int main(int argc, const char* argv[])
 {
     std::string test{"redis"};
 
+    // redis, sqlite, memory or sqlite_benchmark [players] [updates]
+    if (argc > 1)
+        test = argv[1];
+
     if (test == "redis")
     {
         std::string host{"127.0.0.1"};
@@ -166,6 +224,49 @@ int main(int argc, const char* argv[])
 
         delete pRanks;
     }
+    else if (test == "memory")
+    {
+        // rankings are kept in memory and written to memory.db every 5 seconds.
+        IRankingServer *pRanks = new CMemoryRankingServer("memory.db", {"", "0_"}, 5000);
+
+        pRanks->UpdateRanking("Pain",   {1,2,3,4,5,6,7, 8, 9}, "0_");
+        pRanks->UpdateRanking("Juan",   {1,2,3,4,6,6,7, 8, 9}, "0_");
+        pRanks->UpdateRanking("Nobo",   {1,2,3,4,0,6,7, 8, 9}, "0_");
+        pRanks->UpdateRanking("#1",     {1,2,3,4, 5, 99,7, 8, 9}, "0_");
+        pRanks->AwaitFutures();
+
+        std::string nickname{"Juan"};
+        pRanks->GetRanking(nickname, [nickname](CPlayerStats& stats)
+        {
+            if(stats.IsValid())
+                std::cout << "[" << stats.GetRank() << "]" << nickname << "\n" << stats << std::endl;
+            else
+                std::cout << "Player not found '" << nickname << "'" << std::endl;
+
+        }, "0_");
+
+        pRanks->GetTopRanking(5, "Score", [](auto& ranks)
+        {
+            int cnt = 1;
+            for (auto &[nickname, stats] : ranks)
+            {
+                std::cout << cnt << ". " << "[" << stats["Score"] << "] " << nickname << std::endl;
+
+                cnt++;
+            }
+
+        }, "0_", true);
+
+        // the destructor persists the changes
+        delete pRanks;
+    }
+    else if (test == "sqlite_benchmark")
+    {
+        int numPlayers = argc > 2 ? std::stoi(argv[2]) : 64;
+        int numUpdates = argc > 3 ? std::stoi(argv[3]) : 2000;
+
+        RunSQLiteBenchmark(numPlayers, numUpdates);
+    }
     
 
     return 0;
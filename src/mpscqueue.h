@@ -0,0 +1,84 @@
+#ifndef MPSC_QUEUE_H
+#define MPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+/**
+ * Unbounded lock-free queue with many producers and a single consumer.
+ * Push() can be called by any thread, TryPop() only by one thread at a time.
+ * Producers swap themselves into the head with a single atomic exchange,
+ * the consumer follows the next pointers from the tail.
+ */
+template <typename T>
+class CMPSCQueue
+{
+    struct CNode
+    {
+        std::atomic<CNode*> m_pNext{nullptr};
+        T m_Value;
+    };
+
+    // last pushed node, producers only
+    std::atomic<CNode*> m_pHead;
+
+    // already consumed node, its successor is the next value. consumer only.
+    CNode* m_pTail;
+
+    std::atomic<size_t> m_Size{0};
+
+   public:
+    CMPSCQueue()
+    {
+        CNode* pStub = new CNode();
+        m_pHead.store(pStub);
+        m_pTail = pStub;
+    }
+
+    CMPSCQueue(const CMPSCQueue&) = delete;
+    CMPSCQueue& operator=(const CMPSCQueue&) = delete;
+
+    // no producer must be running anymore.
+    ~CMPSCQueue()
+    {
+        T value;
+        while (TryPop(value))
+        {
+        }
+        delete m_pTail;
+    }
+
+    void Push(T value)
+    {
+        CNode* pNode = new CNode();
+        pNode->m_Value = std::move(value);
+
+        m_Size.fetch_add(1, std::memory_order_relaxed);
+
+        CNode* pPrev = m_pHead.exchange(pNode, std::memory_order_acq_rel);
+        pPrev->m_pNext.store(pNode, std::memory_order_release);
+    }
+
+    // returns false if the queue is empty.
+    // a value that is being pushed right now might not be visible yet.
+    bool TryPop(T& value)
+    {
+        CNode* pTail = m_pTail;
+        CNode* pNext = pTail->m_pNext.load(std::memory_order_acquire);
+        if (!pNext)
+            return false;
+
+        value = std::move(pNext->m_Value);
+        m_pTail = pNext;
+        delete pTail;
+
+        m_Size.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // approximate number of values in the queue
+    size_t Size() const { return m_Size.load(std::memory_order_relaxed); };
+};
+
+#endif // MPSC_QUEUE_H
@@ -0,0 +1,265 @@
+#ifndef ORDER_TREE_H
+#define ORDER_TREE_H
+
+#include <cstdint>
+#include <functional>
+#include <random>
+#include <utility>
+
+/**
+ * Balanced binary search tree(treap) that knows the size of every subtree.
+ * Besides insert, erase and lookup, it can tell the position of a value in the sorted
+ * order and the value at a given position, everything in O(log n).
+ * Values are unique with respect to Compare.
+ */
+template <typename T, typename Compare = std::less<T> >
+class COrderStatisticTree
+{
+    struct CNode
+    {
+        T m_Value;
+        uint32_t m_Priority;
+        size_t m_Size{1};
+        CNode* m_pLeft{nullptr};
+        CNode* m_pRight{nullptr};
+
+        CNode(const T& value, uint32_t priority) : m_Value{value}, m_Priority{priority} {}
+    };
+
+    CNode* m_pRoot{nullptr};
+    Compare m_Compare;
+
+    // random priorities keep the tree balanced in expectation
+    std::minstd_rand m_Random;
+
+    static size_t Size(const CNode* pNode) { return pNode ? pNode->m_Size : 0; }
+    static void UpdateSize(CNode* pNode) { pNode->m_Size = 1 + Size(pNode->m_pLeft) + Size(pNode->m_pRight); }
+
+    // splits the subtree into the values that are less than value and all others.
+    void Split(CNode* pNode, const T& value, CNode*& pLeft, CNode*& pRight)
+    {
+        if (!pNode)
+        {
+            pLeft = pRight = nullptr;
+            return;
+        }
+
+        if (m_Compare(pNode->m_Value, value))
+        {
+            Split(pNode->m_pRight, value, pNode->m_pRight, pRight);
+            pLeft = pNode;
+        }
+        else
+        {
+            Split(pNode->m_pLeft, value, pLeft, pNode->m_pLeft);
+            pRight = pNode;
+        }
+        UpdateSize(pNode);
+    }
+
+    // all values of pLeft need to be less than the values of pRight.
+    static CNode* Merge(CNode* pLeft, CNode* pRight)
+    {
+        if (!pLeft)
+            return pRight;
+        if (!pRight)
+            return pLeft;
+
+        if (pLeft->m_Priority > pRight->m_Priority)
+        {
+            pLeft->m_pRight = Merge(pLeft->m_pRight, pRight);
+            UpdateSize(pLeft);
+            return pLeft;
+        }
+
+        pRight->m_pLeft = Merge(pLeft, pRight->m_pLeft);
+        UpdateSize(pRight);
+        return pRight;
+    }
+
+    CNode* Insert(CNode* pNode, CNode* pNew)
+    {
+        if (!pNode)
+            return pNew;
+
+        if (pNew->m_Priority > pNode->m_Priority)
+        {
+            Split(pNode, pNew->m_Value, pNew->m_pLeft, pNew->m_pRight);
+            UpdateSize(pNew);
+            return pNew;
+        }
+
+        if (m_Compare(pNew->m_Value, pNode->m_Value))
+            pNode->m_pLeft = Insert(pNode->m_pLeft, pNew);
+        else
+            pNode->m_pRight = Insert(pNode->m_pRight, pNew);
+
+        UpdateSize(pNode);
+        return pNode;
+    }
+
+    CNode* Erase(CNode* pNode, const T& value, bool& erased)
+    {
+        if (!pNode)
+            return nullptr;
+
+        if (m_Compare(value, pNode->m_Value))
+        {
+            pNode->m_pLeft = Erase(pNode->m_pLeft, value, erased);
+        }
+        else if (m_Compare(pNode->m_Value, value))
+        {
+            pNode->m_pRight = Erase(pNode->m_pRight, value, erased);
+        }
+        else
+        {
+            CNode* pMerged = Merge(pNode->m_pLeft, pNode->m_pRight);
+            delete pNode;
+            erased = true;
+            return pMerged;
+        }
+
+        UpdateSize(pNode);
+        return pNode;
+    }
+
+    // skips the first values of the subtree and calls fn on the following ones until count is 0.
+    template <typename Fn>
+    static void Visit(const CNode* pNode, size_t& first, size_t& count, Fn& fn)
+    {
+        if (!pNode || count == 0)
+            return;
+
+        size_t leftSize = Size(pNode->m_pLeft);
+        if (first < leftSize)
+            Visit(pNode->m_pLeft, first, count, fn);
+        else
+            first -= leftSize;
+
+        if (count == 0)
+            return;
+
+        if (first == 0)
+        {
+            fn(pNode->m_Value);
+            count--;
+        }
+        else
+        {
+            first--;
+        }
+
+        Visit(pNode->m_pRight, first, count, fn);
+    }
+
+    static void Destroy(CNode* pNode)
+    {
+        if (!pNode)
+            return;
+
+        Destroy(pNode->m_pLeft);
+        Destroy(pNode->m_pRight);
+        delete pNode;
+    }
+
+   public:
+    COrderStatisticTree() = default;
+    COrderStatisticTree(const COrderStatisticTree&) = delete;
+    COrderStatisticTree& operator=(const COrderStatisticTree&) = delete;
+    ~COrderStatisticTree() { Clear(); }
+
+    size_t Size() const { return Size(m_pRoot); };
+    bool Empty() const { return m_pRoot == nullptr; };
+
+    void Clear()
+    {
+        Destroy(m_pRoot);
+        m_pRoot = nullptr;
+    }
+
+    // returns false if the value already exists.
+    bool Insert(const T& value)
+    {
+        if (Contains(value))
+            return false;
+
+        m_pRoot = Insert(m_pRoot, new CNode(value, static_cast<uint32_t>(m_Random())));
+        return true;
+    }
+
+    // returns false if the value does not exist.
+    bool Erase(const T& value)
+    {
+        bool erased = false;
+        m_pRoot = Erase(m_pRoot, value, erased);
+        return erased;
+    }
+
+    bool Contains(const T& value) const
+    {
+        const CNode* pNode = m_pRoot;
+        while (pNode)
+        {
+            if (m_Compare(value, pNode->m_Value))
+                pNode = pNode->m_pLeft;
+            else if (m_Compare(pNode->m_Value, value))
+                pNode = pNode->m_pRight;
+            else
+                return true;
+        }
+        return false;
+    }
+
+    // number of values that are less than value, which is the 0-based position of value if it exists.
+    size_t Rank(const T& value) const
+    {
+        size_t rank = 0;
+        const CNode* pNode = m_pRoot;
+        while (pNode)
+        {
+            if (m_Compare(pNode->m_Value, value))
+            {
+                rank += Size(pNode->m_pLeft) + 1;
+                pNode = pNode->m_pRight;
+            }
+            else
+            {
+                pNode = pNode->m_pLeft;
+            }
+        }
+        return rank;
+    }
+
+    // value at the 0-based position, index needs to be less than Size().
+    const T& At(size_t index) const
+    {
+        const CNode* pNode = m_pRoot;
+        while (true)
+        {
+            size_t leftSize = Size(pNode->m_pLeft);
+            if (index < leftSize)
+            {
+                pNode = pNode->m_pLeft;
+            }
+            else if (index == leftSize)
+            {
+                return pNode->m_Value;
+            }
+            else
+            {
+                index -= leftSize + 1;
+                pNode = pNode->m_pRight;
+            }
+        }
+    }
+
+    // calls fn(const T&) on at most count values in sorted order, starting at position first.
+    // O(log n + count)
+    template <typename Fn>
+    void ForEach(size_t first, size_t count, Fn fn) const
+    {
+        Visit(m_pRoot, first, count, fn);
+    }
+};
+
+#endif // ORDER_TREE_H
@@ -1,18 +1,29 @@
 #include "playerstats.h"
 
+#include <charconv>
+#include <cstdint>
+#include <stdexcept>
+
 
 CPlayerStats::CPlayerStats(): CPlayerStats(0, 0, 0, 0, 0, 0, 0, 0, 0)
 {
     
 }
 
-void CPlayerStats::Reset()
+int CPlayerStats::FieldIndex(const std::string& key)
 {
-    m_IsValid = true;
-    for (auto& [key, value] : m_Data)
+    for (size_t i = 0; i < ms_FieldNames.size(); i++)
     {
-        value = 0;
+        if (key == ms_FieldNames[i])
+            return static_cast<int>(i);
     }
+    return -1;
+}
+
+void CPlayerStats::Reset()
+{
+    m_IsValid = true;
+    m_Data.fill(0);
     m_Rank = -1;
 }
 
@@ -24,80 +35,122 @@ void CPlayerStats::Invalidate() {
 CPlayerStats::CPlayerStats(int kills, int deaths, int ticksCaught, int ticksIngame, int ticksWarmup, int score, int wins, int fails, int shots) : m_IsValid{true}
 {
     m_Rank = -1;
-    m_Data = {
-        {"Kills", kills},
-        {"Deaths", deaths},
-        {"TicksCaught", ticksCaught},
-        {"TicksIngame", ticksIngame},
-        {"TicksWarmup", ticksWarmup},
-        {"Score", score},
-        {"Wins", wins},
-        {"Fails", fails},
-        {"Shots", shots}
-    };
+    m_Data[KILLS] = kills;
+    m_Data[DEATHS] = deaths;
+    m_Data[TICKS_CAUGHT] = ticksCaught;
+    m_Data[TICKS_INGAME] = ticksIngame;
+    m_Data[TICKS_WARMUP] = ticksWarmup;
+    m_Data[SCORE] = score;
+    m_Data[WINS] = wins;
+    m_Data[FAILS] = fails;
+    m_Data[SHOTS] = shots;
 }
 
-std::vector<std::string> CPlayerStats::keys(std::string prefix) const
+const std::vector<std::string>& CPlayerStats::keys()
 {
-    std::vector<std::string> v;
-    v.reserve(m_Data.size());
-
-    for (auto& [key, value] : m_Data)
-    {
-        if(prefix.size() > 0)
-        {
-            v.push_back(prefix + key);
-        }
-        else
-        {
-            v.push_back(key);
-        }       
-    }
-
-    return v;
+    static const std::vector<std::string> s_Keys(ms_FieldNames.begin(), ms_FieldNames.end());
+    return s_Keys;
 }
 
 std::vector<int> CPlayerStats::values() const
 {
-    std::vector<int> v;
-    v.reserve(m_Data.size());
+    return std::vector<int>(m_Data.begin(), m_Data.end());
+}
 
-    for (auto& [key, value] : m_Data)
-    {
-        v.push_back(value);      
-    }
-    return v;
+std::string_view CPlayerStats::FormatValue(int value, CPlayerStats::format_buffer_t& buffer)
+{
+    auto [end, error] = std::to_chars(buffer.data(), buffer.data() + buffer.size(), value);
+    return std::string_view(buffer.data(), end - buffer.data());
 }
 
-std::vector<std::pair<std::string, std::string>> CPlayerStats::GetStringPairs(std::string prefix) const
+bool CPlayerStats::ParseValue(std::string_view str, int& value)
 {
-    std::vector<std::pair<std::string, std::string> > v;
-    v.reserve(m_Data.size());
+    auto [end, error] = std::from_chars(str.data(), str.data() + str.size(), value);
+    return error == std::errc() && end == str.data() + str.size();
+}
 
-    for (auto& [key, value] : m_Data)
+void CPlayerStats::GetStringPairs(std::vector<std::pair<std::string, std::string>>& pairs, const std::vector<std::string>& fieldKeys) const
+{
+    format_buffer_t buffer;
+
+    pairs.resize(m_Data.size());
+    for (size_t i = 0; i < m_Data.size(); i++)
     {
-        v.emplace_back(prefix + key, std::to_string(value));
+        pairs[i].first.assign(fieldKeys[i]);
+        pairs[i].second.assign(FormatValue(m_Data[i], buffer));
     }
-
-    return v;
 }
 
 CPlayerStats& CPlayerStats::operator+=(const CPlayerStats& rhs)
 {
-    for (auto&& [key, value] : m_Data)
+    // the sums wrap around on overflow instead of being undefined.
+    for (size_t i = 0; i < m_Data.size(); i++)
     {
-        value += rhs.m_Data.at(key);
-    }   
+        m_Data[i] = static_cast<int>(static_cast<uint32_t>(m_Data[i]) + static_cast<uint32_t>(rhs.m_Data[i]));
+    }
     return (*this);
 }
 
 CPlayerStats CPlayerStats::operator+(const CPlayerStats& rhs)
 {
-    return CPlayerStats() += rhs;
+    return CPlayerStats(*this) += rhs;
 }
 
 int& CPlayerStats::operator[](const std::string& key)
 {
-    return m_Data.at(key);
+    int field = FieldIndex(key);
+    if (field < 0)
+        throw std::out_of_range("Invalid stats key: " + key);
+
+    return m_Data[field];
 }
 
+int CPlayerStats::operator[](const std::string& key) const
+{
+    int field = FieldIndex(key);
+    if (field < 0)
+        throw std::out_of_range("Invalid stats key: " + key);
+
+    return m_Data[field];
+}
+
+CKeyTable::CKeyTable() : CKeyTable([](const std::string& prefix) { return prefix; })
+{
+}
+
+CKeyTable::CKeyTable(std::function<std::string(const std::string&)> makeKeyPrefix) : m_MakeKeyPrefix{std::move(makeKeyPrefix)}
+{
+}
+
+const std::vector<std::string>& CKeyTable::Get(const std::string& prefix) const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    // references to the elements of an unordered_map are not invalidated by later insertions.
+    auto it = m_Keys.find(prefix);
+    if (it != m_Keys.end())
+        return it->second;
+
+    std::vector<std::string> keys;
+    Make(prefix, keys);
+    return m_Keys.emplace(prefix, std::move(keys)).first->second;
+}
+
+const std::vector<std::string>* CKeyTable::Find(const std::string& prefix) const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    auto it = m_Keys.find(prefix);
+    return it != m_Keys.end() ? &it->second : nullptr;
+}
+
+void CKeyTable::Make(const std::string& prefix, std::vector<std::string>& keys) const
+{
+    std::string keyPrefix = m_MakeKeyPrefix(prefix);
+    keys.clear();
+    keys.reserve(CPlayerStats::ms_FieldNames.size());
+    for (auto& key : CPlayerStats::ms_FieldNames)
+    {
+        keys.push_back(keyPrefix + key);
+    }
+}
@@ -1,26 +1,64 @@
 #ifndef PLAYER_STATS_H
 #define PLAYER_STATS_H
 
-#include <map>
+#include <array>
+#include <functional>
+#include <mutex>
 #include <ostream>
 #include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 
 struct CPlayerStats
 {
     /**
-     * If you want to change this class, all you need to do is to change the costructors
-     * and the stats fields that are pushed in the constructor into m_Data.
+     * If you want to change this class, all you need to do is to change the field schema below
+     * and the constructor that initializes the fields.
+     * The fields are sorted by name, that's the order of keys() and values().
      */
+    enum
+    {
+        DEATHS = 0,
+        FAILS,
+        KILLS,
+        SCORE,
+        SHOTS,
+        TICKS_CAUGHT,
+        TICKS_INGAME,
+        TICKS_WARMUP,
+        WINS,
+        NUM_FIELDS
+    };
+
+    // field names that are used as keys by the backends, index is the field from above.
+    static constexpr std::array<const char*, NUM_FIELDS> ms_FieldNames{{
+        "Deaths",
+        "Fails",
+        "Kills",
+        "Score",
+        "Shots",
+        "TicksCaught",
+        "TicksIngame",
+        "TicksWarmup",
+        "Wins",
+    }};
+
+    // returns the field of the key, -1 if the key does not exist.
+    static int FieldIndex(const std::string& key);
+
    private:
     bool m_IsValid;
 
     ssize_t m_Rank;
 
+    // flat storage, copying and adding does not allocate anything.
+    std::array<int, NUM_FIELDS> m_Data;
+
    public:
-    std::map<std::string, int> m_Data;
     void Invalidate();
-    bool IsValid() { return m_IsValid; };
+    bool IsValid() const { return m_IsValid; };
 
     void Reset();
     CPlayerStats();
@@ -33,22 +71,75 @@ struct CPlayerStats
 
     CPlayerStats operator+(const CPlayerStats& rhs);
 
+    // throws std::out_of_range if the key does not exist.
     int& operator[](const std::string& key);
+    int operator[](const std::string& key) const;
 
-    std::vector<std::string> keys(std::string prefix = "") const;
+    int& Get(int field) { return m_Data[field]; };
+    int Get(int field) const { return m_Data[field]; };
+
+    int& Deaths() { return m_Data[DEATHS]; };
+    int& Fails() { return m_Data[FAILS]; };
+    int& Kills() { return m_Data[KILLS]; };
+    int& Score() { return m_Data[SCORE]; };
+    int& Shots() { return m_Data[SHOTS]; };
+    int& TicksCaught() { return m_Data[TICKS_CAUGHT]; };
+    int& TicksIngame() { return m_Data[TICKS_INGAME]; };
+    int& TicksWarmup() { return m_Data[TICKS_WARMUP]; };
+    int& Wins() { return m_Data[WINS]; };
+
+    // field names, the list is created once and kept until the program exits.
+    // field names with a prefix prepended are interned by a CKeyTable.
+    static const std::vector<std::string>& keys();
     std::vector<int> values() const;
 
-    std::vector<std::pair<std::string, std::string>> GetStringPairs(std::string prefix = "") const;
+    // decimal representation of a value, the buffer fits the sign and all digits of an int.
+    using format_buffer_t = std::array<char, 12>;
+    static std::string_view FormatValue(int value, format_buffer_t& buffer);
+
+    // parses a value that has been written by FormatValue, returns false if str is not a number.
+    static bool ParseValue(std::string_view str, int& value);
+
+    // fills pairs with [key, value] of every field, the strings of the passed vector are reused.
+    // fieldKeys: field names in the order of the fields, e.g. a list of a CKeyTable.
+    void GetStringPairs(std::vector<std::pair<std::string, std::string>>& pairs, const std::vector<std::string>& fieldKeys = keys()) const;
+
+    size_t size() const { return m_Data.size(); };
+};
+
+static_assert(std::is_trivially_copyable<CPlayerStats>::value, "CPlayerStats is copied by value between threads");
+
+// field names with a prefix prepended, the list of a prefix is created once by Get()
+// and kept until the table is destroyed, the returned references stay valid until then.
+// the table is not limited, prefixes that callers can choose freely are built with Make() instead.
+class CKeyTable
+{
+    mutable std::mutex m_Mutex;
+    mutable std::unordered_map<std::string, std::vector<std::string>> m_Keys;
+
+    // returns the string that is prepended to the field names of a prefix.
+    std::function<std::string(const std::string&)> m_MakeKeyPrefix;
+
+   public:
+    // by default the prefix itself is prepended.
+    CKeyTable();
+    explicit CKeyTable(std::function<std::string(const std::string&)> makeKeyPrefix);
+
+    const std::vector<std::string>& Get(const std::string& prefix) const;
+
+    // nullptr if the list of the prefix has not been created by Get().
+    const std::vector<std::string>* Find(const std::string& prefix) const;
 
-    size_t size() { return m_Data.size(); };
+    // fills keys with the list of the prefix without keeping it.
+    void Make(const std::string& prefix, std::vector<std::string>& keys) const;
 };
 
 static std::ostream& operator<<(std::ostream& os, const CPlayerStats& stats)
 {
     os << "PlayerStats:\n{\n";
-    for (auto& [key, value] : stats.GetStringPairs())
+    for (size_t i = 0; i < stats.size(); i++)
     {
-        os << "  " << key << ": " << value << std::endl;
+        os << "  " << CPlayerStats::ms_FieldNames[i] << ": " << stats.Get(i) << std::endl;
     }
     os << "}\n";
 
@@ -0,0 +1,131 @@
+#include "playerstatsbatch.h"
+
+#include <stdexcept>
+
+// RANKINGSERVER_SCALAR_BATCH compiles the scalar kernel only, the tests compare it with the vector kernels.
+#if !defined(RANKINGSERVER_SCALAR_BATCH) && defined(__AVX2__)
+#define BATCH_AVX2
+#include <immintrin.h>
+#elif !defined(RANKINGSERVER_SCALAR_BATCH) && defined(__SSE2__)
+#define BATCH_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+#if defined(BATCH_AVX2)
+    constexpr size_t LANES = 8;
+#elif defined(BATCH_SSE2)
+    constexpr size_t LANES = 4;
+#else
+    constexpr size_t LANES = 1;
+#endif
+
+    // signed overflow is undefined, the scalar code adds unsigned like the vector instructions do.
+    inline int WrappingAdd(int lhs, int rhs)
+    {
+        return static_cast<int>(static_cast<unsigned>(lhs) + static_cast<unsigned>(rhs));
+    }
+
+    void AddColumn(int* pDst, const int* pSrc, size_t size)
+    {
+        size_t i = 0;
+#if defined(BATCH_AVX2)
+        for (; i + LANES <= size; i += LANES)
+        {
+            __m256i dst = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pDst + i));
+            __m256i src = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pSrc + i));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(pDst + i), _mm256_add_epi32(dst, src));
+        }
+#elif defined(BATCH_SSE2)
+        for (; i + LANES <= size; i += LANES)
+        {
+            __m128i dst = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pDst + i));
+            __m128i src = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pSrc + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(pDst + i), _mm_add_epi32(dst, src));
+        }
+#endif
+        for (; i < size; i++)
+        {
+            pDst[i] = WrappingAdd(pDst[i], pSrc[i]);
+        }
+    }
+} // namespace
+
+CPlayerStatsBatch::CPlayerStatsBatch(size_t size)
+{
+    Resize(size);
+}
+
+CPlayerStatsBatch::CPlayerStatsBatch(const std::vector<CPlayerStats>& stats)
+{
+    Resize(stats.size());
+
+    for (size_t row = 0; row < stats.size(); row++)
+    {
+        Set(row, stats[row]);
+    }
+}
+
+void CPlayerStatsBatch::Resize(size_t size)
+{
+    for (auto& column : m_Columns)
+    {
+        column.resize(size, 0);
+    }
+}
+
+void CPlayerStatsBatch::Reserve(size_t size)
+{
+    for (auto& column : m_Columns)
+    {
+        column.reserve(size);
+    }
+}
+
+void CPlayerStatsBatch::Clear()
+{
+    for (auto& column : m_Columns)
+    {
+        column.clear();
+    }
+}
+
+size_t CPlayerStatsBatch::Push(const CPlayerStats& stats)
+{
+    for (size_t field = 0; field < m_Columns.size(); field++)
+    {
+        m_Columns[field].push_back(stats.Get(field));
+    }
+    return Size() - 1;
+}
+
+void CPlayerStatsBatch::Set(size_t row, const CPlayerStats& stats)
+{
+    for (size_t field = 0; field < m_Columns.size(); field++)
+    {
+        m_Columns[field][row] = stats.Get(field);
+    }
+}
+
+CPlayerStats CPlayerStatsBatch::Get(size_t row) const
+{
+    CPlayerStats stats;
+    for (size_t field = 0; field < m_Columns.size(); field++)
+    {
+        stats.Get(field) = m_Columns[field][row];
+    }
+    return stats;
+}
+
+CPlayerStatsBatch& CPlayerStatsBatch::operator+=(const CPlayerStatsBatch& deltas)
+{
+    if (deltas.Size() != Size())
+        throw std::invalid_argument("CPlayerStatsBatch: cannot add batches of different sizes.");
+
+    for (size_t field = 0; field < m_Columns.size(); field++)
+    {
+        AddColumn(m_Columns[field].data(), deltas.m_Columns[field].data(), Size());
+    }
+    return *this;
+}
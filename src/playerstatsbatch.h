@@ -0,0 +1,42 @@
+#ifndef PLAYER_STATS_BATCH_H
+#define PLAYER_STATS_BATCH_H
+
+#include "playerstats.h"
+
+#include <array>
+#include <vector>
+
+/**
+ * Columnar(structure of arrays) storage of many CPlayerStats, one column per field.
+ * Adding whole columns is vectorized with AVX2 or SSE2, depending on
+ * the instruction set the file is compiled for, with a scalar fallback.
+ * Like CPlayerStats::operator+=, sums wrap around on overflow.
+ */
+class CPlayerStatsBatch
+{
+    std::array<std::vector<int>, CPlayerStats::NUM_FIELDS> m_Columns;
+
+   public:
+    CPlayerStatsBatch() = default;
+    explicit CPlayerStatsBatch(size_t size);
+    explicit CPlayerStatsBatch(const std::vector<CPlayerStats>& stats);
+
+    size_t Size() const { return m_Columns[0].size(); };
+
+    // new rows are zero initialized.
+    void Resize(size_t size);
+    void Reserve(size_t size);
+    void Clear();
+
+    // appends a row, returns its index.
+    size_t Push(const CPlayerStats& stats);
+
+    void Set(size_t row, const CPlayerStats& stats);
+    CPlayerStats Get(size_t row) const;
+
+    // adds the rows of deltas to the rows with the same index, e.g. the deltas of a round to the totals.
+    // throws std::invalid_argument if the sizes differ.
+    CPlayerStatsBatch& operator+=(const CPlayerStatsBatch& deltas);
+};
+
+#endif // PLAYER_STATS_BATCH_H
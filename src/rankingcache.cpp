@@ -0,0 +1,386 @@
+#include "rankingcache.h"
+
+#include <algorithm>
+
+std::string CRankingCache::MakeKey(const std::string& nickname, const std::string& prefix)
+{
+    // nicknames cannot contain a 0 byte, the key is unique.
+    std::string key;
+    key.reserve(prefix.size() + 1 + nickname.size());
+    key.append(prefix);
+    key.push_back('\0');
+    key.append(nickname);
+    return key;
+}
+
+size_t CRankingCache::GetEntrySize(const CEntry& entry)
+{
+    // list node(entry + two pointers), index node(key copy, iterator, next pointer and hash)
+    size_t listNode = sizeof(CEntry) + 2 * sizeof(void*);
+    size_t indexNode = sizeof(std::string) + sizeof(std::list<CEntry>::iterator) + 2 * sizeof(void*);
+    return listNode + indexNode + 2 * entry.m_Key.capacity();
+}
+
+void CRankingCache::Erase(std::list<CEntry>::iterator it)
+{
+    m_UsedBytes -= GetEntrySize(*it);
+    m_Index.erase(it->m_Key);
+    m_Entries.erase(it);
+}
+
+uint64_t& CRankingCache::PrefixGeneration(const std::string& prefix)
+{
+    auto it = m_PrefixGenerations.find(prefix);
+    if (it == m_PrefixGenerations.end())
+        it = m_PrefixGenerations.emplace(prefix, m_ClearGeneration).first;
+
+    // the prefix has not been invalidated since the last Clear()
+    it->second = std::max(it->second, m_ClearGeneration);
+    return it->second;
+}
+
+void CRankingCache::Configure(size_t maxBytes, int maxAgeMs)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_Entries.clear();
+    m_Index.clear();
+    m_UsedBytes = 0;
+    m_ClearGeneration = ++m_Generation;
+
+    m_MaxBytes = maxBytes;
+    m_MaxAgeMs = maxAgeMs;
+    m_Enabled = maxBytes > 0;
+}
+
+bool CRankingCache::Get(const std::string& nickname, const std::string& prefix, CPlayerStats& stats)
+{
+    if (!m_Enabled)
+        return false;
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    auto it = m_Index.find(MakeKey(nickname, prefix));
+    if (it == m_Index.end())
+    {
+        m_Misses++;
+        return false;
+    }
+
+    auto entryIt = it->second;
+    if (*entryIt->m_pPrefixGeneration != entryIt->m_Generation ||
+        (m_MaxAgeMs > 0 && std::chrono::steady_clock::now() - entryIt->m_Inserted > std::chrono::milliseconds(m_MaxAgeMs)))
+    {
+        // the rank might be outdated
+        Erase(entryIt);
+        m_Misses++;
+        return false;
+    }
+
+    // mark as most recently used
+    m_Entries.splice(m_Entries.begin(), m_Entries, entryIt);
+    stats = entryIt->m_Stats;
+
+    m_Hits++;
+    return true;
+}
+
+uint64_t CRankingCache::GetGeneration(const std::string& prefix)
+{
+    // the first generation after Configure() is bigger than 0, nothing is inserted with 0.
+    if (!m_Enabled)
+        return 0;
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return PrefixGeneration(prefix);
+}
+
+void CRankingCache::Insert(const std::string& nickname, const std::string& prefix, const CPlayerStats& stats, uint64_t generation)
+{
+    if (!m_Enabled)
+        return;
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    // a write of the prefix happened while the stats were retrieved, they might be outdated.
+    uint64_t& prefixGeneration = PrefixGeneration(prefix);
+    if (generation != prefixGeneration)
+        return;
+
+    std::string key = MakeKey(nickname, prefix);
+    auto it = m_Index.find(key);
+    if (it != m_Index.end())
+        Erase(it->second);
+
+    m_Entries.push_front({key, stats, std::chrono::steady_clock::now(), &prefixGeneration, prefixGeneration});
+    m_Index.emplace(std::move(key), m_Entries.begin());
+    m_UsedBytes += GetEntrySize(m_Entries.front());
+
+    // the new entry is kept, even if it is bigger than the whole cache.
+    while (m_UsedBytes > m_MaxBytes && m_Entries.size() > 1)
+    {
+        Erase(std::prev(m_Entries.end()));
+        m_Evictions++;
+    }
+}
+
+void CRankingCache::Invalidate(const std::string& nickname, const std::string& prefix)
+{
+    if (!m_Enabled)
+        return;
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    // the other entries of the prefix are dropped when they are requested or evicted.
+    PrefixGeneration(prefix) = ++m_Generation;
+
+    auto it = m_Index.find(MakeKey(nickname, prefix));
+    if (it != m_Index.end())
+        Erase(it->second);
+}
+
+void CRankingCache::Clear()
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_ClearGeneration = ++m_Generation;
+    m_Entries.clear();
+    m_Index.clear();
+    m_UsedBytes = 0;
+}
+
+size_t CRankingCache::GetSize()
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_Entries.size();
+}
+
+size_t CRankingCache::GetUsedBytes()
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_UsedBytes;
+}
+
+bool CLeaderboardCache::IsBetter(const std::pair<std::string, CPlayerStats>& lhs, const std::pair<std::string, CPlayerStats>& rhs, int field, bool biggestFirst) const
+{
+    int lhsValue = lhs.second.Get(field);
+    int rhsValue = rhs.second.Get(field);
+
+    if (lhsValue != rhsValue)
+        return biggestFirst ? lhsValue > rhsValue : lhsValue < rhsValue;
+
+    return biggestFirst && m_DescendingTies ? lhs.first > rhs.first : lhs.first < rhs.first;
+}
+
+CLeaderboardCache::CWriteScope::CWriteScope(CLeaderboardCache& cache) : m_Cache{cache}
+{
+    std::lock_guard<std::mutex> lock(m_Cache.m_Mutex);
+    m_Cache.m_Writes++;
+    m_Cache.m_ActiveWrites++;
+}
+
+CLeaderboardCache::CWriteScope::~CWriteScope()
+{
+    std::lock_guard<std::mutex> lock(m_Cache.m_Mutex);
+    m_Cache.m_Writes++;
+    m_Cache.m_ActiveWrites--;
+}
+
+void CLeaderboardCache::Configure(size_t topK, int ttlMs)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_Boards.clear();
+    m_Writes++;
+
+    m_TopK = topK;
+    m_TtlMs = ttlMs;
+    m_Enabled = topK > 0;
+}
+
+void CLeaderboardCache::SetDescendingTies(bool descendingTies)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_Boards.clear();
+    m_Writes++;
+
+    m_DescendingTies = descendingTies;
+}
+
+bool CLeaderboardCache::Get(int topNumber, const std::string& key, const std::string& prefix, bool biggestFirst, key_stats_vec_t& result)
+{
+    if (!m_Enabled)
+        return false;
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    if (topNumber < 0 || static_cast<size_t>(topNumber) > m_TopK)
+        return false;
+
+    auto it = m_Boards.find({prefix, key, biggestFirst});
+    if (it == m_Boards.end() || it->second.m_Stale ||
+        (m_TtlMs > 0 && std::chrono::steady_clock::now() - it->second.m_Refreshed > std::chrono::milliseconds(m_TtlMs)))
+    {
+        m_Misses++;
+        return false;
+    }
+
+    const key_stats_vec_t& entries = it->second.m_Entries;
+    size_t count = std::min(static_cast<size_t>(topNumber), entries.size());
+
+    result.assign(entries.begin(), entries.begin() + count);
+    for (size_t i = 0; i < result.size(); i++)
+    {
+        result[i].second.SetRank(i + 1);
+    }
+
+    m_Hits++;
+    return true;
+}
+
+uint64_t CLeaderboardCache::GetWriteCount()
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_Writes;
+}
+
+void CLeaderboardCache::Store(const std::string& key, const std::string& prefix, bool biggestFirst, const key_stats_vec_t& board, uint64_t writeCount)
+{
+    if (!m_Enabled)
+        return;
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    CBoard& cached = m_Boards[{prefix, key, biggestFirst}];
+    cached.m_Entries = board;
+    if (cached.m_Entries.size() > m_TopK)
+        cached.m_Entries.resize(m_TopK);
+
+    cached.m_Complete = board.size() < m_TopK;
+
+    // the board might or might not contain the writes that have been applied in the meantime.
+    cached.m_Stale = writeCount != m_Writes || m_ActiveWrites > 0;
+    cached.m_Refreshed = std::chrono::steady_clock::now();
+}
+
+void CLeaderboardCache::Place(CBoard& board, int field, bool biggestFirst, const std::string& nickname, const CPlayerStats& stats)
+{
+    key_stats_vec_t& entries = board.m_Entries;
+    std::pair<std::string, CPlayerStats> entry{nickname, stats};
+
+    auto it = std::find_if(entries.begin(), entries.end(), [&nickname](const auto& listed) { return listed.first == nickname; });
+    bool wasListed = it != entries.end();
+    if (wasListed)
+        entries.erase(it);
+
+    bool beatsLast = entries.empty() || IsBetter(entry, entries.back(), field, biggestFirst);
+
+    if (!board.m_Complete && !beatsLast)
+    {
+        // unknown players might be ranked between the last listed player and this one.
+        if (wasListed)
+            board.m_Stale = true;
+        return;
+    }
+
+    auto pos = std::lower_bound(entries.begin(), entries.end(), entry, [this, field, biggestFirst](const auto& lhs, const auto& rhs) {
+        return IsBetter(lhs, rhs, field, biggestFirst);
+    });
+    entries.insert(pos, entry);
+
+    if (entries.size() > m_TopK)
+    {
+        entries.pop_back();
+        board.m_Complete = false;
+    }
+}
+
+void CLeaderboardCache::OnSet(const std::string& nickname, const CPlayerStats& stats, const std::string& prefix)
+{
+    if (!m_Enabled)
+        return;
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_Writes++;
+
+    for (auto& [boardKey, board] : m_Boards)
+    {
+        auto& [boardPrefix, key, biggestFirst] = boardKey;
+        if (boardPrefix != prefix)
+            continue;
+
+        Place(board, CPlayerStats::FieldIndex(key), biggestFirst, nickname, stats);
+    }
+}
+
+void CLeaderboardCache::OnUpdate(const std::string& nickname, const CPlayerStats& delta, const CPlayerStats& total, const std::string& prefix)
+{
+    if (!m_Enabled)
+        return;
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_Writes++;
+
+    for (auto& [boardKey, board] : m_Boards)
+    {
+        auto& [boardPrefix, key, biggestFirst] = boardKey;
+        if (boardPrefix != prefix)
+            continue;
+
+        int field = CPlayerStats::FieldIndex(key);
+        if (total.IsValid())
+        {
+            // placed against the last listed player, like a set
+            Place(board, field, biggestFirst, nickname, total);
+            continue;
+        }
+
+        auto it = std::find_if(board.m_Entries.begin(), board.m_Entries.end(), [&nickname](const auto& listed) { return listed.first == nickname; });
+        if (it != board.m_Entries.end())
+        {
+            // the total of a listed player is known
+            CPlayerStats stats = it->second;
+            stats += delta;
+            Place(board, field, biggestFirst, nickname, stats);
+        }
+        else if (board.m_Complete)
+        {
+            // all players are listed, this is a new player.
+            Place(board, field, biggestFirst, nickname, delta);
+        }
+        else if (biggestFirst ? delta.Get(field) > 0 : delta.Get(field) < 0)
+        {
+            // the player's total is unknown, it might pass the last listed player.
+            board.m_Stale = true;
+        }
+    }
+}
+
+void CLeaderboardCache::OnDelete(const std::string& nickname, const std::string& prefix)
+{
+    if (!m_Enabled)
+        return;
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_Writes++;
+
+    for (auto& [boardKey, board] : m_Boards)
+    {
+        if (std::get<0>(boardKey) != prefix)
+            continue;
+
+        auto it = std::find_if(board.m_Entries.begin(), board.m_Entries.end(), [&nickname](const auto& listed) { return listed.first == nickname; });
+        if (it == board.m_Entries.end())
+            continue;
+
+        board.m_Entries.erase(it);
+
+        // the next player is unknown
+        if (!board.m_Complete)
+            board.m_Stale = true;
+    }
+}
+
+void CLeaderboardCache::Clear()
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_Writes++;
+    m_Boards.clear();
+}
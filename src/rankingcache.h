@@ -0,0 +1,205 @@
+#ifndef RANKING_CACHE_H
+#define RANKING_CACHE_H
+
+#include "playerstats.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * Bounded LRU cache of GetRanking results, keyed by nickname and prefix.
+ * A write changes the ranks of the other players of its prefix, every prefix has a generation
+ * that is increased by the writes. Entries of an older generation of their prefix are not served.
+ * maxAgeMs limits how long a result can be served, e.g. if other processes write the database.
+ *
+ * Results that have been retrieved while a write of their prefix was executed are not inserted, see Insert().
+ */
+class CRankingCache
+{
+    struct CEntry
+    {
+        std::string m_Key;
+        CPlayerStats m_Stats;
+        std::chrono::steady_clock::time_point m_Inserted;
+
+        // generation of the prefix when the entry has been inserted
+        const uint64_t* m_pPrefixGeneration;
+        uint64_t m_Generation;
+    };
+
+    std::mutex m_Mutex;
+
+    // most recently used entry first
+    std::list<CEntry> m_Entries;
+    std::unordered_map<std::string, std::list<CEntry>::iterator> m_Index;
+
+    // 0 -> disabled
+    size_t m_MaxBytes{0};
+    int m_MaxAgeMs{0};
+    size_t m_UsedBytes{0};
+
+    // every invalidation takes the next generation.
+    uint64_t m_Generation{0};
+
+    // prefix -> generation of its last invalidation, the elements are never removed.
+    std::unordered_map<std::string, uint64_t> m_PrefixGenerations;
+
+    // generation of the last Clear(), all prefixes have been invalidated.
+    uint64_t m_ClearGeneration{0};
+
+    std::atomic<bool> m_Enabled{false};
+    std::atomic<size_t> m_Hits{0};
+    std::atomic<size_t> m_Misses{0};
+    std::atomic<size_t> m_Evictions{0};
+
+    static std::string MakeKey(const std::string& nickname, const std::string& prefix);
+
+    // approximate memory usage of an entry, including the list node and the index entry.
+    static size_t GetEntrySize(const CEntry& entry);
+
+    // the mutex needs to be locked.
+    void Erase(std::list<CEntry>::iterator it);
+
+    // current generation of the prefix, the mutex needs to be locked.
+    uint64_t& PrefixGeneration(const std::string& prefix);
+
+   public:
+    // maxBytes = 0 disables the cache, maxAgeMs = 0 keeps the entries until they are evicted.
+    // all cached entries are dropped.
+    void Configure(size_t maxBytes, int maxAgeMs = 0);
+    bool IsEnabled() const { return m_Enabled; };
+
+    // returns true and fills stats, if the player is cached.
+    bool Get(const std::string& nickname, const std::string& prefix, CPlayerStats& stats);
+
+    // needs to be retrieved before the stats are read from the database.
+    uint64_t GetGeneration(const std::string& prefix);
+
+    // caches the stats, unless the prefix has been invalidated since generation has been retrieved.
+    void Insert(const std::string& nickname, const std::string& prefix, const CPlayerStats& stats, uint64_t generation);
+
+    // needs to be called before and after the player is written.
+    // the cached results of all players of the prefix are outdated afterwards.
+    void Invalidate(const std::string& nickname, const std::string& prefix);
+    void Clear();
+
+    size_t GetHits() const { return m_Hits; };
+    size_t GetMisses() const { return m_Misses; };
+    size_t GetEvictions() const { return m_Evictions; };
+    size_t GetSize();
+    size_t GetUsedBytes();
+};
+
+/**
+ * Materialized top K lists per prefix, key and order.
+ * Writes patch the cached lists in place: sets, deletes and updates whose new total is known
+ * keep the list exact. If the total of an update is unknown, a list that the player might
+ * enter is retrieved again with the next request.
+ */
+class CLeaderboardCache
+{
+   public:
+    using key_stats_vec_t = std::vector<std::pair<std::string, CPlayerStats> >;
+
+   private:
+    struct CBoard
+    {
+        // best first, at most K entries
+        key_stats_vec_t m_Entries;
+
+        // there are not more than the listed players
+        bool m_Complete{false};
+
+        // a listed player has moved down or has been deleted, the board needs to be retrieved again.
+        bool m_Stale{false};
+
+        std::chrono::steady_clock::time_point m_Refreshed;
+    };
+
+    // prefix, key, biggest first
+    using board_key_t = std::tuple<std::string, std::string, bool>;
+
+    std::mutex m_Mutex;
+    std::map<board_key_t, CBoard> m_Boards;
+
+    // 0 -> disabled
+    size_t m_TopK{0};
+    int m_TtlMs{0};
+
+    // number of writes that have been started or applied to the boards
+    uint64_t m_Writes{0};
+
+    // writes that have been started and not been applied to the boards yet
+    size_t m_ActiveWrites{0};
+
+    // boards with the biggest values first order equal values by descending nickname(e.g. ZREVRANGE),
+    // otherwise equal values are always ordered by ascending nickname.
+    bool m_DescendingTies{false};
+
+    std::atomic<bool> m_Enabled{false};
+    std::atomic<size_t> m_Hits{0};
+    std::atomic<size_t> m_Misses{0};
+
+    // true if lhs is ranked before rhs, equal values are ordered by nickname.
+    bool IsBetter(const std::pair<std::string, CPlayerStats>& lhs, const std::pair<std::string, CPlayerStats>& rhs, int field, bool biggestFirst) const;
+
+    // puts the player's new stats on the board, the mutex needs to be locked.
+    void Place(CBoard& board, int field, bool biggestFirst, const std::string& nickname, const CPlayerStats& stats);
+
+   public:
+    // lists of topK players are kept, topK = 0 disables the cache.
+    // ttlMs > 0: lists that are older than this are retrieved again.
+    // all cached lists are dropped.
+    void Configure(size_t topK, int ttlMs);
+    bool IsEnabled() const { return m_Enabled; };
+
+    // the order of equal values needs to match the order of the backend, all cached lists are dropped.
+    void SetDescendingTies(bool descendingTies);
+
+    // number of players that need to be retrieved, in order to store a board.
+    size_t GetTopK() const { return m_TopK; };
+
+    // returns true and fills result with topNumber players, if the board is cached.
+    bool Get(int topNumber, const std::string& key, const std::string& prefix, bool biggestFirst, key_stats_vec_t& result);
+
+    // needs to be retrieved before the board is read from the database.
+    uint64_t GetWriteCount();
+
+    // stores the board that has been retrieved with GetTopK() as topNumber.
+    // if any write happened since writeCount has been retrieved or a write is still in progress,
+    // the board is refreshed with the next request.
+    void Store(const std::string& key, const std::string& prefix, bool biggestFirst, const key_stats_vec_t& board, uint64_t writeCount);
+
+    // marks a write as in progress from before the database is written until the boards have been patched,
+    // reads that might see the write without its patch do not store their board.
+    class CWriteScope
+    {
+        CLeaderboardCache& m_Cache;
+
+       public:
+        explicit CWriteScope(CLeaderboardCache& cache);
+        ~CWriteScope();
+    };
+
+    // need to be called after the player has been written, before the next read can happen.
+    // total: the player's stats after the update, invalid if the backend did not return them.
+    void OnSet(const std::string& nickname, const CPlayerStats& stats, const std::string& prefix);
+    void OnUpdate(const std::string& nickname, const CPlayerStats& delta, const CPlayerStats& total, const std::string& prefix);
+    void OnDelete(const std::string& nickname, const std::string& prefix);
+
+    void Clear();
+
+    size_t GetHits() const { return m_Hits; };
+    size_t GetMisses() const { return m_Misses; };
+};
+
+#endif // RANKING_CACHE_H
@@ -1,20 +1,131 @@
 #include "rankingserver.h"
+#include "playerstatsbatch.h"
+#include <sqlite3.h>
 #include <algorithm>
 #include <chrono>
 #include <future>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <queue>
+#include <stdexcept>
 
 IRankingServer::IRankingServer()
 {
     // all possible fields are invalid nicks
-    CPlayerStats tmp;
-    m_InvalidNicknames = tmp.keys();
+    m_InvalidNicknames = CPlayerStats::keys();
+
+    m_IndexedFields.fill(true);
 }
 
 IRankingServer::~IRankingServer()
 {
-    // in any case, await futures, if the derived class does not do this.
+    // in any case, await the submitted tasks, if the derived class does not do this.
+    StopWorkers();
+}
+
+std::unique_lock<std::mutex> IRankingServer::LockForReading()
+{
+    return std::unique_lock<std::mutex>(m_DatabaseMutex);
+}
+
+std::unique_lock<std::mutex> IRankingServer::LockForWriting()
+{
+    return std::unique_lock<std::mutex>(m_DatabaseMutex);
+}
+
+bool IRankingServer::HasUncommittedWrites()
+{
+    return false;
+}
+
+bool IRankingServer::IsDegraded()
+{
+    return false;
+}
+
+std::string IRankingServer::NormalizePrefix(const std::string& prefix)
+{
+    return prefix;
+}
+
+bool IRankingServer::IsValidPrefix(const std::string& prefix)
+{
+    return true;
+}
+
+bool IRankingServer::SubmitJob(std::function<void()> job)
+{
+    // counted before it is queued, a worker might finish it before Submit() returns.
+    m_InFlightJobs++;
+
+    bool submitted = m_WorkerPool.Submit([this, task = std::move(job)]() {
+        try
+        {
+            task();
+        }
+        catch (const std::exception& e)
+        {
+            std::cout << "[IRankingServer] task failed: " << e.what() << std::endl;
+        }
+        FinishJob();
+    });
+
+    if (!submitted)
+    {
+        std::cout << "[IRankingServer] job queue is full or not running, task was not started." << std::endl;
+        FinishJob();
+        return false;
+    }
+    return true;
+}
+
+void IRankingServer::FinishJob()
+{
+    if (--m_InFlightJobs > 0)
+        return;
+
+    // the waiting thread checks the counter while holding the mutex, the notification cannot get lost.
+    std::lock_guard<std::mutex> lock(m_InFlightMutex);
+    m_InFlightCondition.notify_all();
+}
+
+void IRankingServer::DispatchCallback(std::function<void()> callback)
+{
+    if (m_UseCompletionQueue)
+        m_Completions.Push(std::move(callback));
+    else
+        callback();
+}
+
+void IRankingServer::SetCompletionQueue(bool enabled)
+{
+    m_UseCompletionQueue = enabled;
+}
+
+size_t IRankingServer::PollCompletions(size_t maxItems)
+{
+    size_t dispatched = 0;
+    std::function<void()> callback;
+
+    while ((maxItems == 0 || dispatched < maxItems) && m_Completions.TryPop(callback))
+    {
+        callback();
+        dispatched++;
+    }
+    return dispatched;
+}
+
+void IRankingServer::StopWorkers()
+{
+    // the timer must not submit any tasks, while the workers are stopped.
+    StopFlushTimer();
     AwaitFutures();
+
+    if (!m_WorkerPool.IsRunning())
+        return;
+
+    m_WorkerPool.Shutdown();
 }
 
 bool IRankingServer::IsValidNickname(const std::string& nickname, const std::string& prefix) const
@@ -36,36 +147,76 @@ bool IRankingServer::IsValidNickname(const std::string& nickname, const std::str
 
 bool IRankingServer::IsValidKey(const std::string& key) const
 {
-    CPlayerStats tmp;
-    bool IsValid = false;
+    return CPlayerStats::FieldIndex(key) >= 0;
+}
 
-    for (auto &k : tmp.keys())
+void IRankingServer::SetIndexedKeys(const std::vector<std::string>& keys)
+{
+    if (keys.empty())
     {
-        if (k == key)
-        {
-            IsValid = true;
-            break;
-        }
+        m_IndexedFields.fill(true);
+        return;
+    }
+
+    m_IndexedFields.fill(false);
+    for (auto& key : keys)
+    {
+        int field = CPlayerStats::FieldIndex(key);
+        if (field < 0)
+            throw std::invalid_argument("Invalid indexed key: " + key);
+
+        m_IndexedFields[field] = true;
+    }
+
+    // player ranks are based on this key
+    m_IndexedFields[CPlayerStats::FieldIndex(m_RankingKey)] = true;
+}
+
+bool IRankingServer::IsIndexedKey(const std::string& key) const
+{
+    int field = CPlayerStats::FieldIndex(key);
+    return field >= 0 && m_IndexedFields[field];
+}
+
+std::vector<std::string> IRankingServer::GetIndexedKeys() const
+{
+    std::vector<std::string> keys;
+    for (int field = 0; field < CPlayerStats::NUM_FIELDS; field++)
+    {
+        if (m_IndexedFields[field])
+            keys.push_back(CPlayerStats::ms_FieldNames[field]);
     }
-    return IsValid;
+    return keys;
 }
 
 bool IRankingServer::GetRanking(std::string nickname, IRankingServer::cb_stats_t callback, std::string prefix)
 {
-    CleanupFutures();
+    FlushIfDue();
 
-    if (m_DefaultConstructed || callback == nullptr || !IsValidNickname(nickname, prefix))
+    if (m_DefaultConstructed || callback == nullptr)
         return false;
 
-    m_Futures.push_back(std::async(
-        std::launch::async, [this](std::string nick, std::function<void(CPlayerStats&)> cb, std::string pref) {
-            CPlayerStats stats;
+    prefix = NormalizePrefix(prefix);
+    if (!IsValidNickname(nickname, prefix))
+        return false;
+
+    return SubmitJob([this, nick = nickname, cb = callback, pref = prefix]() {
+        CPlayerStats stats;
+        if (!m_RankingCache.Get(nick, pref, stats))
+        {
             try
             {
-                // lock mutex for multi threaded access
-                std::lock_guard<std::mutex> lock(m_DatabaseMutex);
+                // writes that happen from now on prevent caching the result.
+                // writes that have happened before might not be visible to the read.
+                uint64_t generation = m_RankingCache.GetGeneration(pref);
+                bool cacheable = !HasUncommittedWrites() && !IsDegraded() && !HasPendingUpdates(pref);
+
+                // lock for multi threaded access
+                auto lock = LockForReading();
 
                 stats = this->GetRankingSync(nick, pref); // get data from server
+                if (cacheable && !IsDegraded())
+                    m_RankingCache.Insert(nick, pref, stats, generation);
             }
             catch (const std::exception& e)
             {
@@ -75,891 +226,3391 @@ bool IRankingServer::GetRanking(std::string nickname, IRankingServer::cb_stats_t
                 // if retrieving fails, nothing is donw.
                 return;
             }
+        }
 
-            // calling callback
-            // this should not hrow anything.
-            cb(stats); // call callback on data
-        },
-        nickname, callback, prefix));
-
-    return true;
+        // calling callback
+        // this should not hrow anything.
+        DispatchCallback([cb, stats]() mutable { cb(stats); }); // call callback on data
+    });
 }
 
 bool IRankingServer::DeleteRanking(std::string nickname, std::string prefix)
 {
-    CleanupFutures();
 
-    if (m_DefaultConstructed || !IsValidNickname(nickname, prefix))
+    if (m_DefaultConstructed)
         return false;
 
-    m_Futures.push_back(
-        std::async(
-            std::launch::async,
-            [this](std::string nick, std::string pref) {
-                try
-                {
-                    // lock mutex for multi threaded access
-                    std::lock_guard<std::mutex> lock(m_DatabaseMutex);
-
-                    this->DeleteRankingSync(nick, pref);
-                }
-                catch (std::exception& e)
-                {
-                    // failed to delete ranking
-                    // adding to backlog
-                    std::lock_guard<std::mutex> lock(m_BacklogMutex);
-                    m_Backlog.push_back({"delete", nick, CPlayerStats(), pref});
-                }
-            },
-            nickname, prefix));
-    return true;
-}
-
-bool IRankingServer::GetTopRanking(int topNumber, std::string key, IRankingServer::cb_key_stats_vec_t callback, std::string prefix, bool biggestFirst)
-{
-    CleanupFutures();
-
-    if (m_DefaultConstructed || callback == nullptr || !IsValidKey(key))
+    prefix = NormalizePrefix(prefix);
+    if (!IsValidNickname(nickname, prefix) || !IsValidPrefix(prefix))
         return false;
-    
 
-    m_Futures.push_back(std::async(
-        std::launch::async,
-        [this](int topNum, std::string field, decltype(callback) cb, std::string pref, bool bigFirst) {
-            std::vector<std::pair<std::string, CPlayerStats> > result;
-
-            try
-            {
-                // lock mutex for multi threaded access
-                std::lock_guard<std::mutex> lock(m_DatabaseMutex);
+    // pending deltas would recreate the deleted player.
+    DiscardPendingUpdates(nickname, prefix);
+    m_RankingCache.Invalidate(nickname, prefix);
+    FlushIfDue();
 
-                result = this->GetTopRankingSync(topNum, field, pref, bigFirst);
-            }
-            catch (const std::exception& e)
-            {
-                std::cout << "[IRankingServer] " << e.what() << '\n';
-                return;
-            }
+    return SubmitJob([this, nick = nickname, pref = prefix]() {
+        try
+        {
+            // lock for multi threaded access
+            auto lock = LockForWriting();
+            CLeaderboardCache::CWriteScope writeScope(m_LeaderboardCache);
 
-            // if no error occurrs, call callback on the result.
-            cb(result);
-        },
-        topNumber, key, callback, prefix, biggestFirst));
+            this->DeleteRankingSync(nick, pref);
+            m_LeaderboardCache.OnDelete(nick, pref);
+        }
+        catch (const std::invalid_argument& e)
+        {
+            // would fail again with every replay
+            std::cout << "[IRankingServer] dropping delete: " << e.what() << '\n';
+            return;
+        }
+        catch (std::exception& e)
+        {
+            // failed to delete ranking
+            // adding to backlog
+            m_Backlog.Add("delete", nick, CPlayerStats(), pref);
+            m_RankingCache.Invalidate(nick, pref);
+            return;
+        }
 
-    return true;
+        // results that have been cached while deleting
+        m_RankingCache.Invalidate(nick, pref);
+        ReplayBacklogIfDue();
+    });
 }
 
-bool IRankingServer::UpdateRanking(std::string nickname, CPlayerStats stats, std::string prefix)
+bool IRankingServer::DeleteRankingBatch(IRankingServer::delete_batch_t batch, IRankingServer::cb_batch_status_t callback)
 {
-    CleanupFutures();
-
-    if (m_DefaultConstructed || !IsValidNickname(nickname, prefix))
+    if (m_DefaultConstructed || batch.size() == 0)
         return false;
 
-    m_Futures.push_back(std::async(
-        std::launch::async,
-        [this](std::string nick, CPlayerStats stat, std::string pref) {
-            try
-            {
-                // lock mutex for multi threaded access
-                std::lock_guard<std::mutex> lock(m_DatabaseMutex);
-
-                // if this somehow fails and throws an error, handle backlogging
-                this->UpdateRankingSync(nick, stat, pref);
-            }
-            catch (const std::exception& e)
-            {
-                std::cout << "[IRankingServer] " << e.what() << '\n';
+    // invalid entries are not passed to the database, their status stays false.
+    std::vector<bool> status(batch.size(), false);
+    std::vector<size_t> positions;
+    delete_batch_t validBatch;
+    positions.reserve(batch.size());
+    validBatch.reserve(batch.size());
 
-                std::lock_guard<std::mutex> lock(m_BacklogMutex);
-                m_Backlog.push_back({"update", nick, stat, pref});
-            }
-        },
-        nickname, stats, prefix));
+    for (size_t i = 0; i < batch.size(); i++)
+    {
+        auto& [nickname, prefix] = batch[i];
+        prefix = NormalizePrefix(prefix);
+        if (!IsValidNickname(nickname, prefix) || !IsValidPrefix(prefix))
+            continue;
 
-    return true;
-}
+        // pending deltas would recreate the deleted player.
+        DiscardPendingUpdates(nickname, prefix);
+        m_RankingCache.Invalidate(nickname, prefix);
 
-bool IRankingServer::SetRanking(std::string nickname, CPlayerStats stats, std::string prefix)
-{
-    CleanupFutures();
+        positions.push_back(i);
+        validBatch.push_back(std::move(batch[i]));
+    }
+    FlushIfDue();
 
-    if (m_DefaultConstructed || !stats.IsValid() || !IsValidNickname(nickname, prefix))
+    if (validBatch.size() == 0)
         return false;
 
-    m_Futures.push_back(std::async(
-        std::launch::async,
-        [this](std::string nick, CPlayerStats stat, std::string pref) {
-            try
-            {
-                // lock mutex for multi threaded access
-                std::lock_guard<std::mutex> lock(m_DatabaseMutex);
+    return SubmitJob([this, entries = std::move(validBatch), pos = std::move(positions), stat = std::move(status), cb = callback]() mutable {
+        std::vector<bool> result = WriteDeletes(entries);
+        bool written = false;
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            stat[pos[i]] = result[i];
+            written = written || result[i];
 
-                // if this fails, we add this pending action to our backlog.
-                this->SetRankingSync(nick, stat, pref);
-            }
-            catch (const std::exception& e)
-            {
-                std::cout << "[IRankingServer] " << e.what() << '\n';
+            // failed entries are handled like failed single deletes.
+            auto& [nickname, prefix] = entries[i];
+            if (!result[i])
+                m_Backlog.Add("delete", nickname, CPlayerStats(), prefix);
+        }
 
-                std::lock_guard<std::mutex> lock(m_BacklogMutex);
-                m_Backlog.push_back({"set", nick, stat, pref});
-            }
-        },
-        nickname, stats, prefix));
+        if (written)
+            ReplayBacklogIfDue();
 
-    return true;
+        if (cb)
+            DispatchCallback([cb, stat = std::move(stat)]() mutable { cb(stat); });
+    });
 }
 
-void IRankingServer::CleanupBacklog()
+bool IRankingServer::DeletePlayer(std::string nickname, IRankingServer::cb_batch_status_t callback)
 {
-    std::lock_guard<std::mutex> lock(m_BacklogMutex);
-    if (m_Backlog.size() > 0)
-    {
-        // we start new threads from here.
-        // if those threads fail, they will keep on waiting
-        // for this mutex, until they add their failed information
-        // back to the backlog.
-
-        // even tho the backlog might be filled again by these actions, it will be ignored
-        // when the ranking server is destroyed, as each element is beeing looked at once at most.
-        int counter = 0;
-        for (size_t i = 0; i < m_Backlog.size(); i++)
-        {
-            auto [action, nickname, stats, prefix] = m_Backlog.back();
-            m_Backlog.pop_back();
-
-            if (action == "update")
-            {
-                UpdateRanking(nickname, stats, prefix);
-                counter++;
-            }
-            else if (action == "delete")
-            {
-                DeleteRanking(nickname, prefix);
-                counter++;
-            }
-            else if (action == "set")
-            {
-                SetRanking(nickname, stats, prefix);
-            }
-        }
+    if (m_DefaultConstructed || nickname.empty())
+        return false;
 
-        std::cout << "[ranking]: Cleaned up " << counter << " backlog tasks." << std::endl;
-    }
-    else
+    delete_batch_t batch;
+    for (auto& prefix : GetKnownPrefixes())
     {
-        // backlog empty
+        batch.emplace_back(nickname, prefix);
     }
+
+    return DeleteRankingBatch(std::move(batch), callback);
 }
 
-void IRankingServer::CleanupFutures()
+bool IRankingServer::GetTopRanking(int topNumber, std::string key, IRankingServer::cb_key_stats_vec_t callback, std::string prefix, bool biggestFirst)
 {
-    if (m_Futures.size() == 0)
-        return;
+    FlushIfDue();
 
-    auto it = std::remove_if(m_Futures.begin(), m_Futures.end(), [&](std::future<void>& f) {
-        if (!f.valid())
-            return true;
+    // keys without an index would need to scan all players.
+    if (m_DefaultConstructed || callback == nullptr || !IsIndexedKey(key))
+        return false;
 
-        if (std::future_status::ready == f.wait_for(std::chrono::milliseconds(0)))
-        {
-            try
-            {
-                f.get();
-            }
-            catch (const std::exception& e)
-            {
-                std::cerr << e.what() << '\n';
-            }
+    prefix = NormalizePrefix(prefix);
 
-            return true;
-        }
-        return false;
-    });
-    m_Futures.erase(it, m_Futures.end());
-}
+    return SubmitJob([this, topNum = topNumber, field = key, cb = callback, pref = prefix, bigFirst = biggestFirst]() {
+        std::vector<std::pair<std::string, CPlayerStats> > result;
 
-void IRankingServer::AwaitFutures()
-{
-    for (auto& f : m_Futures)
-    {
-        if (f.valid())
+        try
         {
-            f.wait();
-            try
+            if (!m_LeaderboardCache.Get(topNum, field, pref, bigFirst, result))
             {
-                f.get();
-            }
-            catch (const std::exception& e)
-            {
-                std::cerr << e.what() << '\n';
+                // lock for multi threaded access
+                auto lock = LockForReading();
+
+                if (m_LeaderboardCache.IsEnabled() && topNum >= 0 && static_cast<size_t>(topNum) <= m_LeaderboardCache.GetTopK())
+                {
+                    // retrieve the whole board, smaller requests are served from it.
+                    // the writes of an open transaction would be missing from the stored board.
+                    uint64_t writeCount = m_LeaderboardCache.GetWriteCount();
+                    bool cacheable = !HasUncommittedWrites() && !IsDegraded();
+
+                    result = this->GetTopRankingSync(m_LeaderboardCache.GetTopK(), field, pref, bigFirst);
+                    if (cacheable && !IsDegraded())
+                        m_LeaderboardCache.Store(field, pref, bigFirst, result, writeCount);
+
+                    if (result.size() > static_cast<size_t>(topNum))
+                        result.resize(topNum);
+                }
+                else
+                {
+                    result = this->GetTopRankingSync(topNum, field, pref, bigFirst);
+                }
             }
         }
-    }
+        catch (const std::exception& e)
+        {
+            std::cout << "[IRankingServer] " << e.what() << '\n';
+            return;
+        }
 
-    m_Futures.clear();
+        // if no error occurrs, call callback on the result.
+        DispatchCallback([cb, result = std::move(result)]() mutable { cb(result); });
+    });
 }
 
-// ############################################################
-
-CRedisRankingServer::CRedisRankingServer()
+bool IRankingServer::UpdateRanking(std::string nickname, CPlayerStats stats, std::string prefix)
 {
-    m_DefaultConstructed = true;
-}
 
-CRedisRankingServer::CRedisRankingServer(std::string host, size_t port, uint32_t timeout, uint32_t reconnect_ms) : m_Host{host}, m_Port{port}
-{
-    m_DefaultConstructed = false;
+    if (m_DefaultConstructed)
+        return false;
 
-    m_ReconnectIntervalMilliseconds = reconnect_ms;
-    try
+    prefix = NormalizePrefix(prefix);
+    if (!IsValidNickname(nickname, prefix) || !IsValidPrefix(prefix))
+        return false;
+
+    if (m_UpdateFlushIntervalMs > 0)
     {
-        m_Client.connect(m_Host, m_Port, nullptr, timeout, 0, reconnect_ms);
-        if (m_Client.is_connected())
+        size_t pendingPlayers = 0;
         {
-            // no reconnection handling necessary
-            std::lock_guard<std::mutex> lock(m_ReconnectHandlerMutex);
-            m_IsReconnectHandlerRunning = false;
-            std::cout << "[redis]: successfully connected to " << m_Host << ":" << m_Port << std::endl;
-        }
-    }
-    catch (const cpp_redis::redis_error& e)
-    {
-        std::cout << "[redis]: initial connection to " << m_Host << ":" << m_Port << " failed." << std::endl;
+            std::lock_guard<std::mutex> lock(m_PendingUpdatesMutex);
+            auto [it, inserted] = m_PendingUpdates.try_emplace({prefix, nickname}, stats);
+            if (!inserted)
+                it->second += stats;
 
-        StartReconnectHandler();
-    }
-}
+            m_PendingDeltas++;
+            pendingPlayers = m_PendingUpdates.size();
+        }
 
-CRedisRankingServer::~CRedisRankingServer()
-{
-    // we still fail to reconnect at shutdown -> force shutdown
-    m_ReconnectHandlerMutex.lock();
-    m_IsReconnectHandlerRunning = false;
-    m_ReconnectHandlerMutex.unlock();
+        // invalidated after the delta is pending: a read either sees the pending delta
+        // or its generation is outdated by the invalidation, it is not cached in both cases.
+        m_RankingCache.Invalidate(nickname, prefix);
 
-    // we need to wait for out futures to finish, before
-    // we can disconnect from the server.
-    AwaitFutures();
+        if (pendingPlayers >= m_UpdateFlushThreshold)
+            Flush();
+        else
+            FlushIfDue();
 
-    if (m_Client.is_connected())
-    {
-        m_Client.disconnect(true);
-        std::cout << "[redis]: disconnected from database" << std::endl;
+        return true;
     }
+
+    m_RankingCache.Invalidate(nickname, prefix);
+    return SubmitUpdate(nickname, stats, prefix);
 }
 
-void CRedisRankingServer::HandleReconnecting()
+bool IRankingServer::SubmitUpdate(std::string nickname, CPlayerStats stats, std::string prefix)
 {
-    while (!m_Client.is_connected())
-    {
+    return SubmitJob([this, nick = nickname, stat = stats, pref = prefix]() {
         try
         {
-            m_Client.connect(m_Host, m_Port);
+            // lock for multi threaded access
+            auto lock = LockForWriting();
+            CLeaderboardCache::CWriteScope writeScope(m_LeaderboardCache);
+
+            // if this somehow fails and throws an error, handle backlogging
+            CPlayerStats total = this->UpdateRankingSync(nick, stat, pref);
+            m_LeaderboardCache.OnUpdate(nick, stat, total, pref);
         }
-        catch (const cpp_redis::redis_error& e)
+        catch (const std::invalid_argument& e)
         {
-            std::cout << "[redis]: Reconnect failed...\n";
+            // would fail again with every replay
+            std::cout << "[IRankingServer] dropping update: " << e.what() << '\n';
+            return;
         }
-
-        // wait
-        std::this_thread::sleep_for(std::chrono::milliseconds(m_ReconnectIntervalMilliseconds));
-
-        std::lock_guard<std::mutex> lock(m_ReconnectHandlerMutex);
-        if (!m_IsReconnectHandlerRunning)
+        catch (const std::exception& e)
         {
-            std::cout << "[redis]: Shutting down reconnect handler.\n";
+            std::cout << "[IRankingServer] " << e.what() << '\n';
 
-            // forceful shutdown, is done, when the ranking server is
-            // shutting down.
-            CleanupBacklog();
+            m_Backlog.Add("update", nick, stat, pref);
+            m_RankingCache.Invalidate(nick, pref);
             return;
         }
-    }
 
-    // connection established
-    std::lock_guard<std::mutex> lock(m_ReconnectHandlerMutex);
-    m_IsReconnectHandlerRunning = false;
-
-    std::cout << "[redis]: Successfully reconnected!\n";
-    // if connection established, try purging the db backlog
-    CleanupBacklog();
+        // results that have been cached while updating
+        m_RankingCache.Invalidate(nick, pref);
+        ReplayBacklogIfDue();
+    });
 }
 
-void CRedisRankingServer::StartReconnectHandler()
+bool IRankingServer::SetRanking(std::string nickname, CPlayerStats stats, std::string prefix)
 {
-    if (m_IsReconnectHandlerRunning)
-        return; // already running
 
-    std::lock_guard<std::mutex> lock(m_ReconnectHandlerMutex);
-    m_IsReconnectHandlerRunning = true;
+    if (m_DefaultConstructed || !stats.IsValid())
+        return false;
 
-    // this needs to be pushed to the front of all futures, as it needs to be handled
-    // last, as it might cause a deadlock
-    m_Futures.push_front(std::async(std::launch::async, &CRedisRankingServer::HandleReconnecting, this));
-}
+    prefix = NormalizePrefix(prefix);
+    if (!IsValidNickname(nickname, prefix) || !IsValidPrefix(prefix))
+        return false;
 
-CPlayerStats CRedisRankingServer::GetRankingSync(std::string nickname, std::string prefix)
-{
-    CPlayerStats stats;
+    // the set values replace everything that has been added before.
+    DiscardPendingUpdates(nickname, prefix);
+    m_RankingCache.Invalidate(nickname, prefix);
+    FlushIfDue();
 
-    try
-    {
-        std::future<cpp_redis::reply> existsFuture = m_Client.exists({nickname});
-        m_Client.sync_commit();
+    return SubmitJob([this, nick = nickname, stat = stats, pref = prefix]() {
+        try
+        {
+            // lock for multi threaded access
+            auto lock = LockForWriting();
+            CLeaderboardCache::CWriteScope writeScope(m_LeaderboardCache);
 
-        cpp_redis::reply existsReply = existsFuture.get();
-
-        if (existsReply.as_integer())
+            // if this fails, we add this pending action to our backlog.
+            this->SetRankingSync(nick, stat, pref);
+            m_LeaderboardCache.OnSet(nick, stat, pref);
+        }
+        catch (const std::invalid_argument& e)
         {
-            std::future<cpp_redis::reply> getFuture = m_Client.hmget(nickname, stats.keys(prefix));
-
-            m_Client.sync_commit();
-            cpp_redis::reply reply = getFuture.get();
-
-            std::vector<cpp_redis::reply> result = reply.as_array();
+            // would fail again with every replay
+            std::cout << "[IRankingServer] dropping set: " << e.what() << '\n';
+            return;
+        }
+        catch (const std::exception& e)
+        {
+            std::cout << "[IRankingServer] " << e.what() << '\n';
 
-            // set every key.
-            int idx = 0;
-            for (auto& key : stats.keys())
-            {
-                if (result.at(idx).is_null())
-                {
-                    // result is null
-                    // key not found
-                    stats.Invalidate();
-                    break; // entry does not exist yet.
-                }
-                else if (result.at(idx).is_string())
-                {
-                    stats[key] = std::stoi(result.at(idx).as_string());
-                }
-                else if (result.at(idx).is_integer())
-                {
-                    stats[key] = result.at(idx).as_integer();
-                }
-                else
-                {
-                    std::cout << "[redis_error]: unkown result type" << std::endl;
-                    stats.Invalidate();
-                    break;
-                }
-                idx++;
-            }
+            m_Backlog.Add("set", nick, stat, pref);
+            m_RankingCache.Invalidate(nick, pref);
+            return;
+        }
 
-            std::string rankingIndex = prefix + m_RankingKey;
+        // results that have been cached while setting
+        m_RankingCache.Invalidate(nick, pref);
+        ReplayBacklogIfDue();
+    });
+}
 
+bool IRankingServer::UpdateRankingBatch(IRankingServer::ranking_batch_t batch, IRankingServer::cb_batch_status_t callback)
+{
+    FlushIfDue();
 
-            if (m_BiggestFirst)
-            {                
-                std::future<cpp_redis::reply> rankFuture = m_Client.zrevrank(rankingIndex, nickname);
+    if (m_DefaultConstructed || batch.size() == 0)
+        return false;
 
-                m_Client.sync_commit();
-                cpp_redis::reply reply = rankFuture.get();
+    return SubmitBatch("update", std::move(batch), callback);
+}
 
-                if (!reply.is_null())
-                {
-                    // redis ranks are couted from 0
-                    stats.SetRank(reply.as_integer() + 1);
-                }
-                else
-                {
-                    stats.Invalidate();
-                }
-            }
-            else
-            {
-                std::future<cpp_redis::reply> rankFuture = m_Client.zrank(rankingIndex, nickname);
+bool IRankingServer::SetRankingBatch(IRankingServer::ranking_batch_t batch, IRankingServer::cb_batch_status_t callback)
+{
 
-                m_Client.sync_commit();
-                cpp_redis::reply reply = rankFuture.get();
+    if (m_DefaultConstructed || batch.size() == 0)
+        return false;
 
-                if (!reply.is_null())
-                {
-                    // redis ranks are couted from 0
-                    stats.SetRank(reply.as_integer() + 1);
-                }
-                else
-                {
-                    stats.Invalidate();
-                }
-            }     
-        }
-        else
-        {
-            // not found
-            stats.Invalidate();
-        }
-        
-        return stats;
-    }
-    catch (const cpp_redis::redis_error& e)
+    // the set values replace everything that has been added before.
+    for (auto& [nickname, stats, prefix] : batch)
     {
-        if (!m_Client.is_connected())
-        {
-            std::cout << "[redis]: lost connection: " << e.what() << std::endl;
-            StartReconnectHandler();
-        }
-
-        throw;
+        prefix = NormalizePrefix(prefix);
+        DiscardPendingUpdates(nickname, prefix);
     }
+    FlushIfDue();
+
+    return SubmitBatch("set", std::move(batch), callback);
 }
 
-IRankingServer::key_stats_vec_t CRedisRankingServer::GetTopRankingSync(int topNumber, std::string key, std::string prefix, bool biggestFirst)
+bool IRankingServer::SubmitBatch(std::string action, IRankingServer::ranking_batch_t batch, IRankingServer::cb_batch_status_t callback)
 {
-    std::string index = prefix + key;
-
-    try
+    // invalid entries are not passed to the database, their status stays false.
+    std::vector<bool> status(batch.size(), false);
+    std::vector<size_t> positions;
+    ranking_batch_t validBatch;
+    positions.reserve(batch.size());
+    validBatch.reserve(batch.size());
+
+    for (size_t i = 0; i < batch.size(); i++)
     {
-        std::future<cpp_redis::reply> existsFuture = m_Client.exists({index});
-        m_Client.sync_commit();
+        auto& [nickname, stats, prefix] = batch[i];
+        prefix = NormalizePrefix(prefix);
+        if (!IsValidNickname(nickname, prefix) || !IsValidPrefix(prefix) || (action == "set" && !stats.IsValid()))
+            continue;
 
-        cpp_redis::reply existsReply = existsFuture.get();
+        m_RankingCache.Invalidate(nickname, prefix);
 
-        if (existsReply.is_integer())
-        {
-            if (existsReply.as_integer() != 0)
-            {
-                // specified index exists
-                std::future<cpp_redis::reply> resultFuture;
+        positions.push_back(i);
+        validBatch.push_back(std::move(batch[i]));
+    }
 
-                if (biggestFirst)
-                {
-                    resultFuture = m_Client.zrevrangebyscore(index, "+inf", "0", 0, topNumber);
-                }
-                else
-                {
-                    resultFuture = m_Client.zrangebyscore(index, "0", "+inf", 0, topNumber);
-                }
+    if (validBatch.size() == 0)
+        return false;
 
-                m_Client.sync_commit();
+    return SubmitJob([this, act = action, entries = std::move(validBatch), pos = std::move(positions), stat = std::move(status), cb = callback]() mutable {
+        std::vector<bool> result = WriteBatch(act, entries);
+        bool written = false;
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            stat[pos[i]] = result[i];
+            written = written || result[i];
 
-                cpp_redis::reply result = resultFuture.get();
+            // failed entries are handled like failed single tasks.
+            auto& [nickname, stats, prefix] = entries[i];
+            if (!result[i])
+                m_Backlog.Add(act, nickname, stats, prefix);
+        }
 
-                if (result.is_array())
-                {
-                    std::vector<std::pair<std::string, CPlayerStats> > sortedResult;
+        if (written)
+            ReplayBacklogIfDue();
 
-                    for (auto& r : result.as_array())
-                    {
-                        if (r.is_string())
-                        {
-                            sortedResult.push_back({r.as_string(), {/* empty*/}});
-                        }
-                        else
-                        {
-                            throw cpp_redis::redis_error("Expected string as nickname.");
-                        }
-                    }
+        if (cb)
+            DispatchCallback([cb, stat = std::move(stat)]() mutable { cb(stat); });
+    });
+}
 
-                    for (auto& [nickname, stats] : sortedResult)
-                    {
-                        stats = GetRankingSync(nickname, prefix);
-                    }
+std::vector<bool> IRankingServer::WriteBatch(const std::string& action, const IRankingServer::ranking_batch_t& batch)
+{
+    std::vector<bool> result(batch.size(), false);
+    try
+    {
+        // lock for multi threaded access
+        auto lock = LockForWriting();
+        CLeaderboardCache::CWriteScope writeScope(m_LeaderboardCache);
 
-                    return sortedResult;
-                }
-                else
-                {
-                    throw cpp_redis::redis_error("Expected array return value of z[rev]rangebyscore(...)");
-                }
-            }
-            else
-            {
-                throw cpp_redis::redis_error("exists: expected integer != 0");
-            }
-        }
+        std::vector<CPlayerStats> totals;
+        if (action == "update")
+            result = this->UpdateRankingBatchSync(batch, totals);
         else
+            result = this->SetRankingBatchSync(batch);
+
+        result.resize(batch.size(), false);
+        totals.resize(batch.size());
+
+        // the boards are patched before the write lock is released.
+        for (size_t i = 0; i < batch.size(); i++)
         {
-            throw cpp_redis::redis_error("exists: expected integer reply");
+            if (!result[i])
+                continue;
+
+            auto& [nickname, stats, prefix] = batch[i];
+            if (action == "update")
+                m_LeaderboardCache.OnUpdate(nickname, stats, totals[i], prefix);
+            else
+                m_LeaderboardCache.OnSet(nickname, stats, prefix);
         }
     }
-    catch (const cpp_redis::redis_error& e)
+    catch (const std::exception& e)
     {
-        // error is propagated to calling function.
-        throw;
+        std::cout << "[IRankingServer] " << e.what() << '\n';
+    }
+
+    // results that have been cached while writing
+    for (auto& [nickname, stats, prefix] : batch)
+    {
+        m_RankingCache.Invalidate(nickname, prefix);
     }
+
+    return result;
 }
 
-void CRedisRankingServer::UpdateRankingSync(std::string nickname, CPlayerStats stats, std::string prefix)
+std::vector<bool> IRankingServer::WriteDeletes(const IRankingServer::delete_batch_t& batch)
 {
+    std::vector<bool> result(batch.size(), false);
     try
     {
-        CPlayerStats dbStats;
-
-        // throws exception, if connection fails
-        dbStats = GetRankingSync(nickname, prefix);
-
-        // is only invalid if player could not be found
-        if (!dbStats.IsValid())
-            dbStats.Reset();
-
-        dbStats += stats;
+        // lock for multi threaded access
+        auto lock = LockForWriting();
+        CLeaderboardCache::CWriteScope writeScope(m_LeaderboardCache);
 
-        std::future<cpp_redis::reply> setFuture = m_Client.hmset(nickname, dbStats.GetStringPairs(prefix));
+        result = this->DeleteRankingBatchSync(batch);
+        result.resize(batch.size(), false);
 
-        // create/update index for every key
-        std::vector<std::string> options = {};
-        std::vector<std::future<cpp_redis::reply> > indexFutures;
-        for (auto& key : dbStats.keys())
+        for (size_t i = 0; i < batch.size(); i++)
         {
-            indexFutures.push_back(
-                m_Client.zadd(prefix + key,
-                              options,
-                              {{std::to_string(dbStats[key]), nickname}}));
+            if (result[i])
+                m_LeaderboardCache.OnDelete(batch[i].first, batch[i].second);
         }
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << "[IRankingServer] " << e.what() << '\n';
+    }
 
-        m_Client.sync_commit();
-        for (auto& f : indexFutures)
-        {
-            cpp_redis::reply r = f.get();
-            // retrieve results
-            // don't do anything with it.
-        }
+    // results that have been cached while deleting
+    for (auto& [nickname, prefix] : batch)
+    {
+        m_RankingCache.Invalidate(nickname, prefix);
     }
-    catch (const cpp_redis::redis_error& e)
+
+    return result;
+}
+
+std::vector<bool> IRankingServer::UpdateRankingBatchSync(const IRankingServer::ranking_batch_t& batch, std::vector<CPlayerStats>& totals)
+{
+    std::vector<bool> status;
+    status.reserve(batch.size());
+    totals.assign(batch.size(), CPlayerStats());
+
+    for (size_t i = 0; i < batch.size(); i++)
     {
-        if (!m_Client.is_connected())
-        {
-            std::cout << "[redis]: lost connection: " << e.what() << std::endl;
-            StartReconnectHandler();
-        }
-        else if (!IsValidNickname(nickname))
+        auto& [nickname, stats, prefix] = batch[i];
+        try
         {
-            std::cout << "invalid nickname: " << nickname << std::endl;
-            return;
+            totals[i] = UpdateRankingSync(nickname, stats, prefix);
+            status.push_back(true);
         }
-        else
+        catch (const std::exception& e)
         {
-            // invalid player nick retrieved.
-            // don't do anything then.
+            std::cout << "[IRankingServer] " << e.what() << '\n';
+            totals[i].Invalidate();
+            status.push_back(false);
         }
-        throw;
     }
+    return status;
 }
 
-void CRedisRankingServer::SetRankingSync(std::string nickname, CPlayerStats stats, std::string prefix)
+std::vector<bool> IRankingServer::SetRankingBatchSync(const IRankingServer::ranking_batch_t& batch)
 {
-    try
-    {
-        std::future<cpp_redis::reply> setFuture = m_Client.hmset(nickname, stats.GetStringPairs(prefix));
+    std::vector<bool> status;
+    status.reserve(batch.size());
 
-        // create/update index for every key
-        std::vector<std::string> options = {};
-        std::vector<std::future<cpp_redis::reply> > indexFutures;
-        for (auto& key : stats.keys())
+    for (auto& [nickname, stats, prefix] : batch)
+    {
+        try
         {
-            indexFutures.push_back(
-                m_Client.zadd(prefix + key,
-                              options,
-                              {{std::to_string(stats[key]), nickname}}));
+            SetRankingSync(nickname, stats, prefix);
+            status.push_back(true);
         }
-
-        m_Client.sync_commit();
-        for (auto& f : indexFutures)
+        catch (const std::exception& e)
         {
-            cpp_redis::reply r = f.get();
-            // retrieve results
-            // don't do anything with it.
+            std::cout << "[IRankingServer] " << e.what() << '\n';
+            status.push_back(false);
         }
     }
-    catch (const cpp_redis::redis_error& e)
+    return status;
+}
+
+std::vector<bool> IRankingServer::DeleteRankingBatchSync(const IRankingServer::delete_batch_t& batch)
+{
+    std::vector<bool> status;
+    status.reserve(batch.size());
+
+    for (auto& [nickname, prefix] : batch)
     {
-        if (!m_Client.is_connected())
-        {
-            std::cout << "[redis]: lost connection: " << e.what() << std::endl;
-            StartReconnectHandler();
-        }
-        else if (!IsValidNickname(nickname))
+        try
         {
-            std::cout << "invalid nickname: " << nickname << std::endl;
-            return;
+            DeleteRankingSync(nickname, prefix);
+            status.push_back(true);
         }
-        else
+        catch (const std::exception& e)
         {
-            // unexpected error
+            std::cout << "[IRankingServer] " << e.what() << '\n';
+            status.push_back(false);
         }
-        // rethrow in order to handle backlog stuff.
-        throw;
     }
+    return status;
 }
 
-void CRedisRankingServer::DeleteRankingSync(std::string nickname, std::string prefix)
+void IRankingServer::CleanupBacklog()
 {
-    try
-    {
-        CPlayerStats stats;
-
-        std::future<cpp_redis::reply> existsFuture = m_Client.exists({nickname});
-        m_Client.sync_commit();
-
-        cpp_redis::reply existsReply = existsFuture.get();
-
-        if (existsReply.as_integer()) // exists
-        {
-            // check if type is hash
-            std::future<cpp_redis::reply> typeFuture = m_Client.type(nickname);
-            m_Client.sync_commit();
-            cpp_redis::reply typeReply = typeFuture.get();
+    auto pEntries = std::make_shared<std::vector<CBacklogJournal::CEntry> >(m_Backlog.TakeForReplay());
+    if (pEntries->size() == 0)
+        return; // backlog empty or already being replayed
+
+    bool submitted = SubmitJob([this, pEntries]() {
+        std::vector<CBacklogJournal::CEntry>& entries = *pEntries;
+        auto start = std::chrono::steady_clock::now();
+
+        // consecutive actions of the same kind are written with a single batch call.
+        std::vector<bool> failed(entries.size(), false);
+        std::string batchAction;
+        std::vector<size_t> batchEntries;
+        ranking_batch_t batch;
+
+        // deletes are batched separately, only one of both batches has entries at a time.
+        std::vector<size_t> deleteEntries;
+        delete_batch_t deletes;
+
+        auto writeBatch = [&]() {
+            if (batch.size() == 0)
+                return;
 
-            if (typeReply.is_string() && typeReply.as_string() != "hash")
+            std::vector<bool> result = WriteBatch(batchAction, batch);
+            for (size_t i = 0; i < batch.size(); i++)
             {
-                std::cout << "Deleting: " << nickname << " failed, type is not hash: " << typeReply.as_string() << std::endl;
-                return; // invalid object
+                if (!result[i])
+                    failed[batchEntries[i]] = true;
             }
-            else if (!typeReply.is_string())
-            {
-                std::cout << "Deleting: " << nickname << " failed, reply not a string." << std::endl;
+            batchEntries.clear();
+            batch.clear();
+        };
+
+        auto writeDeletes = [&]() {
+            if (deletes.size() == 0)
                 return;
+
+            std::vector<bool> result = WriteDeletes(deletes);
+            for (size_t i = 0; i < deletes.size(); i++)
+            {
+                // the action must not be executed without the delete,
+                // a failed action is restored without the delete.
+                if (!result[i])
+                    failed[deleteEntries[i]] = true;
+                else
+                    entries[deleteEntries[i]].m_Delete = false;
             }
+            deleteEntries.clear();
+            deletes.clear();
+        };
 
-            // all keys represent individual index names
-            std::future<cpp_redis::reply> allKeysFuture = m_Client.hkeys(nickname);
-            m_Client.sync_commit();
-            cpp_redis::reply keysReply = allKeysFuture.get();
+        // e.g. entries of a journal that has been written with another prefix list
+        size_t dropped = 0;
 
-            // contains keys that ought to be deleted
-            // these keys also identify the sorted set indices
-            std::vector<std::string> keys;
-            if (keysReply.is_array())
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            auto& entry = entries[i];
+            if (!IsValidNickname(entry.m_Nickname, entry.m_Prefix) || !IsValidPrefix(entry.m_Prefix) ||
+                (entry.m_Action == "set" && !entry.m_Stats.IsValid()))
             {
-                for (auto& key : keysReply.as_array())
-                {
-                    if (key.is_string())
-                    {
-                        keys.push_back(key.as_string());
-                    }
-                    else if (key.is_integer())
-                    {
-                        keys.push_back(std::to_string(key.as_integer()));
-                    }
-                    else
-                    {
-                        // invalid case
-                        continue;
-                    }
-                }
+                std::cout << "[ranking]: dropping invalid backlog entry: '" << entry.m_Nickname << "', prefix: '" << entry.m_Prefix << "'" << std::endl;
+                dropped++;
+                continue;
             }
-            else
+
+            if (entry.m_Delete)
             {
-                std::cout << "failed to retrieve all field names, returned not an array." << std::endl;
-                return;
+                writeBatch();
+
+                deleteEntries.push_back(i);
+                deletes.emplace_back(entry.m_Nickname, entry.m_Prefix);
+                if (deletes.size() >= m_BacklogReplayBatchSize)
+                    writeDeletes();
             }
 
-            std::future<cpp_redis::reply> delFuture;
-            std::vector<std::future<cpp_redis::reply> > delIndicesFutures;
+            if (entry.m_Action.empty())
+                continue;
 
-            if (prefix.size() > 0)
-            {
-                // remove keys that don't have the correct prefix
-                keys.erase(std::remove_if(keys.begin(), keys.end(), [&prefix](const std::string& key) {
-                               if (key.size() < prefix.size())
-                               {
-                                   return true; // delete invalid key from vector
-                               }
-
-                               // expect key and prefix length to be at least equal
-                               for (size_t i = 0; i < prefix.size(); i++)
-                               {
-                                   // prefix doesn't match
-                                   if (key.at(i) != prefix.at(i))
-                                       return true; // remove key, cuz invalid prefix
-                               }
-                               // full prefix matches, don't remove
-                               return false;
-                           }),
-                           keys.end());
-
-                if (keys.size() == 0)
-                {
-                    std::cout << "no keys matching prefix: '" << prefix << "'. Did not delete any entries for " << nickname << std::endl;
-                    return;
-                }
+            // the delete of the entry needs to be executed before its action
+            writeDeletes();
+            if (failed[i])
+                continue;
 
-                // delete only specified fields with prefix
-                delFuture = m_Client.hdel(nickname, keys);
-            }
-            else
-            {
-                // delete all player data
-                delFuture = m_Client.del({nickname});
-            }
+            if (entry.m_Action != batchAction || batch.size() >= m_BacklogReplayBatchSize)
+                writeBatch();
 
-            // remove idices
+            batchAction = entry.m_Action;
+            batchEntries.push_back(i);
+            batch.emplace_back(entry.m_Nickname, entry.m_Stats, entry.m_Prefix);
+        }
+        writeDeletes();
+        writeBatch();
 
-            for (auto& key : keys)
+        size_t replayed = 0;
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            if (!failed[i])
             {
-                delIndicesFutures.push_back(m_Client.zrem(key, {nickname}));
+                replayed++;
+                continue;
             }
 
-            m_Client.sync_commit();
-            cpp_redis::reply reply = delFuture.get();
+            m_Backlog.Restore(entries[i]);
+        }
 
-            int result = 0;
-            if (reply.is_integer())
-            {
-                result = reply.as_integer();
-            }
-            else
-            {
-                std::cout << "Invalid result, expected integer: " << reply << std::endl;
-            }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        m_Backlog.FinishReplay(replayed, seconds);
 
-            if (!result)
-            {
-                throw cpp_redis::redis_error("deletion failed");
-            }
+        if (dropped > 0)
+            std::cout << "[ranking]: dropped " << dropped << " invalid backlog entries" << std::endl;
 
-            int tmp = 0;
-            for (auto& f : delIndicesFutures)
-            {
-                cpp_redis::reply delIndexReply = f.get();
+        std::cout << "[ranking]: Replayed " << replayed - dropped << " of " << entries.size() << " backlog entries in "
+                  << static_cast<int>(seconds * 1000) << " ms(" << static_cast<size_t>(m_Backlog.GetReplayRate()) << " entries/s), "
+                  << m_Backlog.GetSize() << " entries(" << m_Backlog.GetFileBytes() << " bytes) left." << std::endl;
+    });
 
-                if (delIndexReply.is_integer())
-                {
-                    tmp = delIndexReply.as_integer();
-                    if (!tmp)
-                    {
-                        std::cout << "Failed to delete an index: " << delIndexReply << std::endl;
-                    }
-                }
-                else
-                {
-                    throw cpp_redis::redis_error("failed to delete index: ");
-                }
-            }
-        }
-    }
-    catch (const cpp_redis::redis_error& e)
+    if (!submitted)
     {
-        if (!m_Client.is_connected())
-        {
-            std::cout << "[redis]: lost connection: " << e.what() << std::endl;
-            StartReconnectHandler();
-            throw;
-        }
-        else
+        // the queue is full, the entries are kept for the next attempt.
+        for (auto& entry : *pEntries)
         {
-            std::cout << "[redis] unexpected error while trying to delete an entry: " << e.what() << std::endl;
+            m_Backlog.Restore(entry);
         }
-        return;
+        m_Backlog.FinishReplay(0, 0.0);
     }
 }
 
-CSQLiteRankingServer::CSQLiteRankingServer()
+void IRankingServer::ReplayBacklogIfDue()
 {
-    m_DefaultConstructed = true;
-    m_pDatabase = nullptr;
+    if (!m_ReplayBacklogAfterWrites || m_Backlog.GetSize() == 0)
+        return;
+
+    int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    int64_t last = m_LastBacklogReplayMs;
+
+    // only one of the workers that see the interval pass starts the replay.
+    if (now - last < m_BacklogReplayIntervalMs || !m_LastBacklogReplayMs.compare_exchange_strong(last, now))
+        return;
+
+    CleanupBacklog();
 }
 
-void CSQLiteRankingServer::FixPrefix(std::string& prefix)
+void IRankingServer::SetBacklogJournal(const std::string& filePath)
 {
-    // replace whitespace with underscore
-    std::transform(prefix.begin(), prefix.end(), prefix.begin(), [](unsigned char ch) {
-        return std::isspace(static_cast<unsigned char>(ch)) ? '_' : ch;
-    });
+    m_Backlog.Open(filePath);
 
-    // prefix must not start with an intger, cuz it's an invalid table name then
-    if (prefix.size() > 0 && std::isdigit(prefix[0]))
-    {
-        prefix = std::string("_") + prefix;
-    }
+    // entries of a previous run
+    if (!m_DefaultConstructed)
+        CleanupBacklog();
 }
 
-CSQLiteRankingServer::CSQLiteRankingServer(std::string filePath, std::vector<std::string> validPrefixList, int busyTimeoutMs)
+void IRankingServer::SetRankingCache(size_t maxBytes, int maxAgeMs)
 {
-    // needed to get keys in order to create table columns
-    CPlayerStats stats;
+    m_RankingCache.Configure(maxBytes, maxAgeMs);
+}
 
-    m_DefaultConstructed = false;
-    m_pDatabase = nullptr;
+void IRankingServer::SetLeaderboardCache(size_t topK, int ttlMs)
+{
+    m_LeaderboardCache.Configure(topK, ttlMs);
+}
 
-    m_ValidPrefixList.reserve(validPrefixList.size());
+void IRankingServer::SetUpdateCoalescing(int flushIntervalMs, size_t maxPendingPlayers)
+{
+    // pending updates must not be lost, when coalescing is disabled.
+    Flush();
 
-    for (auto& prefix : validPrefixList)
+    {
+        std::lock_guard<std::mutex> lock(m_PendingUpdatesMutex);
+        m_UpdateFlushIntervalMs = flushIntervalMs;
+        m_UpdateFlushThreshold = maxPendingPlayers > 0 ? maxPendingPlayers : 1;
+        m_LastUpdateFlush = std::chrono::steady_clock::now();
+    }
+
+    if (m_DefaultConstructed || flushIntervalMs <= 0)
+        return;
+
+    std::lock_guard<std::mutex> lock(m_FlushMutex);
+    if (m_StopFlushing)
+        return;
+
+    if (!m_FlushThread.joinable())
+        m_FlushThread = std::thread(&IRankingServer::HandleFlushTimer, this);
+    else
+        m_FlushCondition.notify_all(); // the interval has changed
+}
+
+void IRankingServer::HandleFlushTimer()
+{
+    std::unique_lock<std::mutex> lock(m_FlushMutex);
+    while (!m_StopFlushing)
+    {
+        int intervalMs = m_UpdateFlushIntervalMs;
+        if (intervalMs > 0)
+            m_FlushCondition.wait_for(lock, std::chrono::milliseconds(intervalMs));
+        else
+            m_FlushCondition.wait(lock); // coalescing has been disabled
+
+        if (m_StopFlushing)
+            break;
+
+        // the public methods might flush at the same time.
+        lock.unlock();
+        FlushIfDue();
+        lock.lock();
+    }
+}
+
+void IRankingServer::StopFlushTimer()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_FlushMutex);
+        m_StopFlushing = true;
+    }
+    m_FlushCondition.notify_all();
+
+    if (m_FlushThread.joinable())
+        m_FlushThread.join();
+}
+
+void IRankingServer::DiscardPendingUpdates(const std::string& nickname, const std::string& prefix)
+{
+    std::lock_guard<std::mutex> lock(m_PendingUpdatesMutex);
+    m_PendingUpdates.erase({prefix, nickname});
+}
+
+bool IRankingServer::HasPendingUpdates(const std::string& prefix)
+{
+    std::lock_guard<std::mutex> lock(m_PendingUpdatesMutex);
+
+    // the entries are ordered by prefix, the first one that is not smaller than [prefix, ""] is of the prefix if there is any.
+    auto it = m_PendingUpdates.lower_bound({prefix, ""});
+    return it != m_PendingUpdates.end() && it->first.first == prefix;
+}
+
+void IRankingServer::FlushIfDue()
+{
+    if (m_UpdateFlushIntervalMs <= 0)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(m_PendingUpdatesMutex);
+        if (std::chrono::steady_clock::now() - m_LastUpdateFlush < std::chrono::milliseconds(m_UpdateFlushIntervalMs))
+            return;
+    }
+    Flush();
+}
+
+size_t IRankingServer::Flush()
+{
+    std::map<std::pair<std::string, std::string>, CPlayerStats> pendingUpdates;
+    size_t mergedDeltas = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_PendingUpdatesMutex);
+        m_LastUpdateFlush = std::chrono::steady_clock::now();
+
+        if (m_PendingUpdates.size() == 0)
+            return 0;
+
+        pendingUpdates.swap(m_PendingUpdates);
+        mergedDeltas = m_PendingDeltas;
+        m_PendingDeltas = 0;
+    }
+
+    // all pending updates are written by a single batch task.
+    ranking_batch_t batch;
+    batch.reserve(pendingUpdates.size());
+    for (auto& [key, stats] : pendingUpdates)
+    {
+        batch.emplace_back(key.second, stats, key.first);
+    }
+
+    if (!SubmitBatch("update", std::move(batch), nullptr))
+    {
+        // job queue is full, keep the deltas for the next flush.
+        std::lock_guard<std::mutex> lock(m_PendingUpdatesMutex);
+        for (auto& [key, stats] : pendingUpdates)
+        {
+            auto [it, inserted] = m_PendingUpdates.try_emplace(key, stats);
+            if (!inserted)
+                it->second += stats;
+        }
+        m_PendingDeltas += mergedDeltas;
+        return 0;
+    }
+
+    m_MergedDeltas += mergedDeltas;
+    return mergedDeltas;
+}
+
+void IRankingServer::AwaitFutures()
+{
+    // pending updates are part of the work that is awaited.
+    Flush();
+
+    std::unique_lock<std::mutex> lock(m_InFlightMutex);
+    m_InFlightCondition.wait(lock, [this]() { return m_InFlightJobs == 0; });
+}
+
+// ############################################################
+
+namespace
+{
+    // 64 bit FNV-1a with a final mix, the tokens of similar endpoints and keys are spread over the whole ring.
+    uint64_t HashRingKey(const std::string& key)
+    {
+        uint64_t hash = 14695981039346656037ULL;
+        for (unsigned char c : key)
+        {
+            hash ^= c;
+            hash *= 1099511628211ULL;
+        }
+
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 33;
+        hash *= 0xc4ceb9fe1a85ec53ULL;
+        hash ^= hash >> 33;
+        return hash;
+    }
+} // namespace
+
+const int CRedisRankingServer::ms_ShardTokens = 128;
+
+CRedisRankingServer::CRedisRankingServer()
+{
+    m_DefaultConstructed = true;
+}
+
+CRedisRankingServer::CRedisRankingServer(std::string host, size_t port, uint32_t timeout, uint32_t reconnect_ms, size_t numWorkers, size_t maxQueuedJobs, size_t numConnections, std::vector<std::string> indexedKeys)
+    : CRedisRankingServer(std::vector<std::string>{host + ":" + std::to_string(port)}, timeout, reconnect_ms, numWorkers, maxQueuedJobs, numConnections, indexedKeys)
+{
+}
+
+CRedisRankingServer::CRedisRankingServer(std::vector<std::string> endpoints, uint32_t timeout, uint32_t reconnect_ms, size_t numWorkers, size_t maxQueuedJobs, size_t numConnections, std::vector<std::string> indexedKeys)
+{
+    m_DefaultConstructed = false;
+    SetIndexedKeys(indexedKeys);
+
+    // the backlog is replayed by the reconnect handler, writes to other shards succeed while one is down.
+    m_ReplayBacklogAfterWrites = false;
+
+    // ZREVRANGE orders equal scores by descending nickname.
+    m_LeaderboardCache.SetDescendingTies(true);
+
+    if (endpoints.size() == 0)
+        throw std::invalid_argument("No redis endpoint given.");
+
+    // every worker can have its own round trip in flight
+    if (numConnections == 0)
+        numConnections = numWorkers > 0 ? numWorkers : 1;
+
+    std::set<std::string> names;
+    for (auto& endpoint : endpoints)
+    {
+        // the host can contain colons(IPv6), the port follows the last one.
+        size_t separator = endpoint.rfind(':');
+        if (separator == std::string::npos || separator == 0 || separator + 1 == endpoint.size() ||
+            endpoint.find_first_not_of("0123456789", separator + 1) != std::string::npos || endpoint.size() - separator > 6)
+            throw std::invalid_argument("Invalid redis endpoint: " + endpoint);
+
+        auto pShard = std::make_unique<CShard>();
+        pShard->m_Host = endpoint.substr(0, separator);
+        pShard->m_Port = std::stoul(endpoint.substr(separator + 1));
+
+        std::string name = pShard->m_Host + ":" + std::to_string(pShard->m_Port);
+        if (!names.insert(name).second)
+            throw std::invalid_argument("Redis endpoint given twice: " + endpoint);
+
+        for (size_t i = 0; i < numConnections; i++)
+        {
+            pShard->m_Connections.push_back(std::make_unique<CConnection>());
+        }
+
+        // the tokens only depend on the endpoint, reordering the endpoints does not move any player.
+        for (int token = 0; token < ms_ShardTokens; token++)
+        {
+            m_Ring.emplace(HashRingKey(name + "#" + std::to_string(token)), m_Shards.size());
+        }
+
+        m_Shards.push_back(std::move(pShard));
+    }
+
+    for (auto& name : names)
+    {
+        m_RingSignature += (m_RingSignature.empty() ? "" : ",") + name;
+    }
+
+    m_WorkerPool.Start(numWorkers, maxQueuedJobs);
+
+    m_ReconnectIntervalMilliseconds = reconnect_ms;
+    std::vector<CShard*> connectedShards;
+    std::vector<CShard*> disconnectedShards;
+    for (auto& pShard : m_Shards)
+    {
+        try
+        {
+            for (auto& pConnection : pShard->m_Connections)
+            {
+                pConnection->m_Client.connect(pShard->m_Host, pShard->m_Port, nullptr, timeout, 0, reconnect_ms);
+            }
+
+            if (IsConnected(*pShard))
+            {
+                // a different ring is refused before any reconnect handler has been started.
+                CheckRing(*pShard);
+
+                // no reconnection handling necessary
+                std::cout << "[redis]: successfully connected to " << pShard->m_Host << ":" << pShard->m_Port << " with " << pShard->m_Connections.size() << " connection(s)" << std::endl;
+                connectedShards.push_back(pShard.get());
+                continue;
+            }
+        }
+        catch (const cpp_redis::redis_error& e)
+        {
+            // handled like a connection that could not be established
+        }
+
+        std::cout << "[redis]: initial connection to " << pShard->m_Host << ":" << pShard->m_Port << " failed." << std::endl;
+        disconnectedShards.push_back(pShard.get());
+    }
+
+    for (CShard* pShard : disconnectedShards)
+    {
+        StartReconnectHandler(*pShard);
+    }
+
+    // the legacy data of a shard can belong to any shard, all of them are connected first.
+    for (CShard* pShard : connectedShards)
+    {
+        PrepareShard(*pShard);
+    }
+}
+
+CRedisRankingServer::~CRedisRankingServer()
+{
+    // we still fail to reconnect at shutdown -> force shutdown
+    for (auto& pShard : m_Shards)
+    {
+        std::lock_guard<std::mutex> lock(pShard->m_ReconnectHandlerMutex);
+        pShard->m_IsReconnectHandlerRunning = false;
+    }
+
+    // the handlers stop after their current interval and queue the backlog.
+    for (auto& pShard : m_Shards)
+    {
+        if (pShard->m_ReconnectFuture.valid())
+            pShard->m_ReconnectFuture.wait();
+    }
+
+    // we need to wait for our tasks to finish, before
+    // we can disconnect from the server.
+    StopWorkers();
+
+    bool disconnected = false;
+    for (auto& pShard : m_Shards)
+    {
+        for (size_t i = 0; i < pShard->m_Connections.size(); i++)
+        {
+            CConnection& connection = *pShard->m_Connections[i];
+            std::cout << "[redis]: " << pShard->m_Host << ":" << pShard->m_Port << " connection " << i << " max in-flight depth: " << connection.m_MaxInFlight << std::endl;
+
+            if (connection.m_Client.is_connected())
+            {
+                connection.m_Client.disconnect(true);
+                disconnected = true;
+            }
+        }
+    }
+
+    if (disconnected)
+        std::cout << "[redis]: disconnected from database" << std::endl;
+}
+
+size_t CRedisRankingServer::GetShardIndex(const std::string& nickname, const std::string& prefix) const
+{
+    if (m_Shards.size() <= 1)
+        return 0;
+
+    // the first token at or after the hash of the player's key owns the player
+    auto it = m_Ring.lower_bound(HashRingKey(GetPlayerKey(nickname, prefix)));
+    if (it == m_Ring.end())
+        it = m_Ring.begin();
+    return it->second;
+}
+
+bool CRedisRankingServer::IsConnected(CShard& shard)
+{
+    for (auto& pConnection : shard.m_Connections)
+    {
+        if (!pConnection->m_Client.is_connected())
+            return false;
+    }
+    return true;
+}
+
+bool CRedisRankingServer::IsAvailable(CShard& shard)
+{
+    {
+        // the reconnect handler holds the connections while it connects and prepares the shard.
+        std::lock_guard<std::mutex> lock(shard.m_ReconnectHandlerMutex);
+        if (shard.m_IsReconnectHandlerRunning)
+            return false;
+    }
+    return IsConnected(shard);
+}
+
+CRedisRankingServer::CConnectionLease::CConnectionLease(CShard& shard) : m_pConnection{nullptr}
+{
+    // the connection with the fewest jobs that use it or wait for it
+    for (auto& pConnection : shard.m_Connections)
+    {
+        if (!m_pConnection || pConnection->m_InFlight < m_pConnection->m_InFlight)
+            m_pConnection = pConnection.get();
+    }
+
+    size_t depth = ++m_pConnection->m_InFlight;
+    size_t maxDepth = m_pConnection->m_MaxInFlight;
+    while (depth > maxDepth && !m_pConnection->m_MaxInFlight.compare_exchange_weak(maxDepth, depth))
+    {
+    }
+
+    m_Lock = std::unique_lock<std::mutex>(m_pConnection->m_Mutex);
+}
+
+CRedisRankingServer::CConnectionLease::~CConnectionLease()
+{
+    m_Lock.unlock();
+    m_pConnection->m_InFlight--;
+}
+
+CRedisRankingServer::CShardLeases::CShardLeases(CRedisRankingServer& server, const std::vector<bool>& usedShards) : m_Leases(server.m_Shards.size())
+{
+    for (size_t i = 0; i < server.m_Shards.size(); i++)
+    {
+        if (usedShards[i])
+            m_Leases[i] = std::make_unique<CConnectionLease>(*server.m_Shards[i]);
+    }
+}
+
+void CRedisRankingServer::HandleConnectionErrors(CShardLeases& leases, const cpp_redis::redis_error& e)
+{
+    for (size_t i = 0; i < m_Shards.size(); i++)
+    {
+        if (!leases.IsLeased(i) || leases.Get(i).is_connected())
+            continue;
+
+        std::cout << "[redis]: lost connection to " << m_Shards[i]->m_Host << ":" << m_Shards[i]->m_Port << ": " << e.what() << std::endl;
+        StartReconnectHandler(*m_Shards[i]);
+    }
+}
+
+std::unique_lock<std::mutex> CRedisRankingServer::LockForReading()
+{
+    // reads only need their own connection(see CConnectionLease), they overlap with each other and with the writes.
+    return std::unique_lock<std::mutex>();
+}
+
+bool CRedisRankingServer::IsDegraded()
+{
+    for (auto& pShard : m_Shards)
+    {
+        if (!IsAvailable(*pShard))
+            return true;
+    }
+    return false;
+}
+
+std::vector<size_t> CRedisRankingServer::GetConnectionDepths() const
+{
+    std::vector<size_t> depths;
+    for (auto& pShard : m_Shards)
+    {
+        for (auto& pConnection : pShard->m_Connections)
+        {
+            depths.push_back(pConnection->m_InFlight);
+        }
+    }
+    return depths;
+}
+
+std::vector<size_t> CRedisRankingServer::GetMaxConnectionDepths() const
+{
+    std::vector<size_t> depths;
+    for (auto& pShard : m_Shards)
+    {
+        for (auto& pConnection : pShard->m_Connections)
+        {
+            depths.push_back(pConnection->m_MaxInFlight);
+        }
+    }
+    return depths;
+}
+
+void CRedisRankingServer::HandleReconnecting(CShard& shard)
+{
+    // returns false, if the ranking server is shutting down.
+    auto waitInterval = [this, &shard]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(m_ReconnectIntervalMilliseconds));
+
+        std::lock_guard<std::mutex> lock(shard.m_ReconnectHandlerMutex);
+        if (!shard.m_IsReconnectHandlerRunning)
+        {
+            std::cout << "[redis]: Shutting down reconnect handler of " << shard.m_Host << ":" << shard.m_Port << ".\n";
+
+            // forceful shutdown, is done, when the ranking server is
+            // shutting down.
+            CleanupBacklog();
+            return false;
+        }
+        return true;
+    };
+
+    while (true)
+    {
+        while (!IsConnected(shard))
+        {
+            for (auto& pConnection : shard.m_Connections)
+            {
+                // jobs that use a disconnected connection fail right away and release it.
+                std::lock_guard<std::mutex> connectionLock(pConnection->m_Mutex);
+                if (pConnection->m_Client.is_connected())
+                    continue;
+
+                try
+                {
+                    pConnection->m_Client.connect(shard.m_Host, shard.m_Port);
+                }
+                catch (const cpp_redis::redis_error& e)
+                {
+                    std::cout << "[redis]: Reconnect to " << shard.m_Host << ":" << shard.m_Port << " failed...\n";
+                    break;
+                }
+            }
+
+            if (IsConnected(shard))
+                break;
+
+            // wait
+            if (!waitInterval())
+                return;
+        }
+
+        try
+        {
+            CheckRing(shard);
+            break;
+        }
+        catch (const std::invalid_argument& e)
+        {
+            std::cout << "[redis]: not using " << shard.m_Host << ":" << shard.m_Port << ": " << e.what() << std::endl;
+        }
+        catch (const cpp_redis::redis_error& e)
+        {
+            std::cout << "[redis]: failed to check the ring of " << shard.m_Host << ":" << shard.m_Port << ": " << e.what() << std::endl;
+        }
+
+        // the shard is not written until it stores the same ring, the check is repeated with the next connection.
+        for (auto& pConnection : shard.m_Connections)
+        {
+            std::lock_guard<std::mutex> connectionLock(pConnection->m_Mutex);
+            if (pConnection->m_Client.is_connected())
+                pConnection->m_Client.disconnect(true);
+        }
+
+        if (!waitInterval())
+            return;
+    }
+
+    // connection established
+    std::cout << "[redis]: Successfully reconnected to " << shard.m_Host << ":" << shard.m_Port << "!\n";
+
+    // the handler mutex must not be locked here, failing jobs lock it while they hold their connection.
+    PrepareShard(shard);
+
+    std::lock_guard<std::mutex> lock(shard.m_ReconnectHandlerMutex);
+    shard.m_IsReconnectHandlerRunning = false;
+
+    // if connection established, try purging the db backlog,
+    // the entries of shards that are still unreachable stay in the backlog.
+    CleanupBacklog();
+}
+
+void CRedisRankingServer::StartReconnectHandler(CShard& shard)
+{
+    std::lock_guard<std::mutex> lock(shard.m_ReconnectHandlerMutex);
+    if (shard.m_IsReconnectHandlerRunning)
+        return; // already running
+
+    shard.m_IsReconnectHandlerRunning = true;
+
+    // a previous handler has already released the mutex and is about to return,
+    // replacing its future waits for it.
+    shard.m_ReconnectFuture = std::async(std::launch::async, &CRedisRankingServer::HandleReconnecting, this, std::ref(shard));
+}
+
+void CRedisRankingServer::CheckRing(CShard& shard)
+{
+    CConnectionLease connection(shard);
+    cpp_redis::client& client = connection.Get();
+
+    // the first connection stores the ring, later ones compare it.
+    client.send({"SET", ms_RingKey, m_RingSignature, "NX"});
+    std::future<cpp_redis::reply> ringFuture = client.send({"GET", ms_RingKey});
+    client.sync_commit();
+
+    cpp_redis::reply ringReply = ringFuture.get();
+    if (!ringReply.is_string())
+        throw cpp_redis::redis_error("GET " + ms_RingKey + ": expected string reply");
+
+    if (ringReply.as_string() != m_RingSignature)
+        throw std::invalid_argument("the shard has been written with the endpoints " + ringReply.as_string() + ", not with " + m_RingSignature +
+                                    ", the players need to be moved to the new endpoints before the shard can be used");
+}
+
+void CRedisRankingServer::PrepareShard(CShard& shard)
+{
+    // writers are blocked until the layout has been migrated, they lease their connections after the write lock.
+    auto lock = LockForWriting();
+
+    try
+    {
+        // the server might have been restarted without its script cache.
+        CConnectionLease connection(shard);
+        LoadScripts(connection.Get());
+    }
+    catch (const cpp_redis::redis_error& e)
+    {
+        std::cout << "[redis]: failed to load the scripts of " << shard.m_Host << ":" << shard.m_Port << ": " << e.what() << std::endl;
+    }
+
+    // the legacy data of every shard can belong to this shard, a migration that
+    // failed because this shard has been unreachable is retried now.
+    for (auto& pShard : m_Shards)
+    {
+        if (!IsConnected(*pShard))
+            continue;
+
+        try
+        {
+            MigrateKeyLayout(*pShard);
+        }
+        catch (const cpp_redis::redis_error& e)
+        {
+            std::cout << "[redis]: failed to migrate the key layout of " << pShard->m_Host << ":" << pShard->m_Port << ": " << e.what() << std::endl;
+        }
+    }
+
+    try
+    {
+        ReconcileIndices(shard);
+
+        // the prefixes of the players that have been written by previous runs
+        CConnectionLease connection(shard);
+        for (auto& prefix : ScanPrefixes(connection.Get()))
+        {
+            AddKnownPrefix(prefix);
+        }
+    }
+    catch (const cpp_redis::redis_error& e)
+    {
+        std::cout << "[redis]: failed to reconcile the indices of " << shard.m_Host << ":" << shard.m_Port << ": " << e.what() << std::endl;
+    }
+}
+
+CPlayerStats CRedisRankingServer::GetRankingSync(std::string nickname, std::string prefix)
+{
+    CPlayerStats stats;
+
+    size_t shardIndex = GetShardIndex(nickname, prefix);
+    CShard& shard = *m_Shards[shardIndex];
+    std::string indexBuffer;
+    const std::string& rankingIndex = GetIndexKey(prefix, CPlayerStats::FieldIndex(m_RankingKey), indexBuffer);
+
+    // the better players of the other shards are counted with the player's score
+    std::string score;
+
+    if (!IsAvailable(shard))
+        throw cpp_redis::redis_error("shard " + shard.m_Host + ":" + std::to_string(shard.m_Port) + " is not available");
+
+    {
+        // the connection is used exclusively until the block is left
+        CConnectionLease connection(shard);
+        cpp_redis::client& client = connection.Get();
+
+        try
+        {
+            // stats and rank are retrieved in a single round trip,
+            // a player that does not exist has only null fields and no rank.
+            std::future<cpp_redis::reply> getFuture = client.hmget(GetPlayerKey(nickname, prefix), CPlayerStats::keys());
+            std::future<cpp_redis::reply> rankFuture = m_BiggestFirst ? client.zrevrank(rankingIndex, nickname) : client.zrank(rankingIndex, nickname);
+            std::future<cpp_redis::reply> scoreFuture;
+            if (m_Shards.size() > 1)
+                scoreFuture = client.send({"ZSCORE", rankingIndex, nickname});
+            client.sync_commit();
+
+            cpp_redis::reply reply = getFuture.get();
+            cpp_redis::reply rankReply = rankFuture.get();
+
+            // set every key.
+            if (!ParseStatsReply(reply, stats))
+            {
+                // not found
+                return stats;
+            }
+
+            if (!rankReply.is_integer())
+            {
+                stats.Invalidate();
+                return stats;
+            }
+
+            // redis ranks are couted from 0
+            stats.SetRank(rankReply.as_integer() + 1);
+
+            if (m_Shards.size() == 1)
+                return stats;
+
+            cpp_redis::reply scoreReply = scoreFuture.get();
+            if (!scoreReply.is_string())
+            {
+                stats.Invalidate();
+                return stats;
+            }
+            score = scoreReply.as_string();
+        }
+        catch (const cpp_redis::redis_error& e)
+        {
+            if (!client.is_connected())
+            {
+                std::cout << "[redis]: lost connection to " << shard.m_Host << ":" << shard.m_Port << ": " << e.what() << std::endl;
+                StartReconnectHandler(shard);
+            }
+
+            throw;
+        }
+    }
+
+    // the other shards are asked at the same time, players with the same score are counted
+    // if they are in front of the player in the merged top ranking. shards that are not available are not counted.
+    std::vector<bool> otherShards(m_Shards.size(), false);
+    for (size_t i = 0; i < m_Shards.size(); i++)
+    {
+        otherShards[i] = i != shardIndex && IsAvailable(*m_Shards[i]);
+    }
+    CShardLeases leases(*this, otherShards);
+
+    std::vector<CScriptCall> calls(m_Shards.size());
+    for (size_t i = 0; i < m_Shards.size(); i++)
+    {
+        if (!leases.IsLeased(i))
+            continue;
+
+        calls[i].m_pScript = &ms_RankScript;
+        calls[i].m_Keys = {rankingIndex};
+        calls[i].m_Args = {score, nickname, m_BiggestFirst ? "1" : "0"};
+        EvalScript(leases.Get(i), calls[i]);
+    }
+
+    std::vector<bool> failedShards(m_Shards.size(), false);
+    CommitShards(leases, otherShards, failedShards);
+
+    for (size_t i = 0; i < m_Shards.size(); i++)
+    {
+        if (!leases.IsLeased(i) || failedShards[i])
+            continue;
+
+        try
+        {
+            GetScriptReplies(leases.Get(i), {&calls[i]});
+            if (!calls[i].m_Reply.is_integer())
+                throw cpp_redis::redis_error("Expected integer return value of the rank script");
+
+            stats.SetRank(stats.GetRank() + calls[i].m_Reply.as_integer());
+        }
+        catch (const cpp_redis::redis_error& e)
+        {
+            if (leases.Get(i).is_connected())
+                throw;
+
+            // the rank of a degraded read is based on the reachable shards.
+            HandleConnectionErrors(leases, e);
+        }
+    }
+
+    return stats;
+}
+
+const std::string CRedisRankingServer::ms_KeySpace = "rank:";
+const std::string CRedisRankingServer::ms_LayoutVersionKey = "rank:version";
+const int CRedisRankingServer::ms_LayoutVersion = 2;
+const std::string CRedisRankingServer::ms_IndexedKeysKey = "rank:indexed";
+const std::string CRedisRankingServer::ms_RingKey = "rank:ring";
+
+std::string CRedisRankingServer::GetKeyPrefix(const std::string& prefix)
+{
+    // an empty hash tag "{}" would not be used for the slot, "p" keeps it non-empty.
+    return ms_KeySpace + "{p" + prefix + "}:";
+}
+
+std::string CRedisRankingServer::GetPlayerKey(const std::string& nickname, const std::string& prefix)
+{
+    return GetKeyPrefix(prefix) + "player:" + nickname;
+}
+
+const std::vector<std::string>& CRedisRankingServer::GetIndexKeys(const std::string& prefix, std::vector<std::string>& buffer) const
+{
+    if (const std::vector<std::string>* pKeys = m_IndexKeys.Find(prefix))
+        return *pKeys;
+
+    m_IndexKeys.Make(prefix, buffer);
+    return buffer;
+}
+
+const std::string& CRedisRankingServer::GetIndexKey(const std::string& prefix, int field, std::string& buffer) const
+{
+    if (const std::vector<std::string>* pKeys = m_IndexKeys.Find(prefix))
+        return (*pKeys)[field];
+
+    buffer = GetKeyPrefix(prefix) + "idx:" + CPlayerStats::ms_FieldNames[field];
+    return buffer;
+}
+
+void CRedisRankingServer::MigrateKeyLayout(CShard& source)
+{
+    // prefix -> nicknames of the legacy player hashes that contain stats of the prefix
+    std::map<std::string, std::set<std::string> > prefixPlayers;
+    {
+        CConnectionLease connection(source);
+        cpp_redis::client& client = connection.Get();
+
+        std::future<cpp_redis::reply> versionFuture = client.send({"GET", ms_LayoutVersionKey});
+        client.sync_commit();
+
+        cpp_redis::reply versionReply = versionFuture.get();
+        if (versionReply.is_string() && versionReply.as_string() == std::to_string(ms_LayoutVersion))
+            return;
+
+        // the stats of a legacy prefix are the fields <prefix><key> of the player hashes <nickname>,
+        // every player of a prefix has the field <prefix><ranking key>.
+        // a prefix without players can still have its sorted sets <prefix><key>.
+        auto getPrefix = [this](const std::string& name, std::string& prefix) {
+            if (name.size() < m_RankingKey.size() || name.compare(name.size() - m_RankingKey.size(), m_RankingKey.size(), m_RankingKey) != 0)
+                return false;
+
+            prefix = name.substr(0, name.size() - m_RankingKey.size());
+            return true;
+        };
+
+        std::string cursor = "0";
+        do
+        {
+            std::future<cpp_redis::reply> scanFuture = client.send({"SCAN", cursor, "COUNT", "1000"});
+            client.sync_commit();
+
+            cpp_redis::reply scanReply = scanFuture.get();
+            if (!scanReply.is_array() || scanReply.as_array().size() != 2 || !scanReply.as_array()[0].is_string() || !scanReply.as_array()[1].is_array())
+                throw cpp_redis::redis_error("SCAN: unexpected reply");
+
+            cursor = scanReply.as_array()[0].as_string();
+
+            std::vector<std::string> keys;
+            for (auto& key : scanReply.as_array()[1].as_array())
+            {
+                if (key.is_string() && key.as_string().compare(0, ms_KeySpace.size(), ms_KeySpace) != 0)
+                    keys.push_back(key.as_string());
+            }
+
+            std::vector<std::future<cpp_redis::reply> > typeFutures;
+            for (auto& key : keys)
+            {
+                typeFutures.push_back(client.type(key));
+            }
+            client.sync_commit();
+
+            std::vector<std::string> hashes;
+            std::string prefix;
+            for (size_t i = 0; i < keys.size(); i++)
+            {
+                cpp_redis::reply typeReply = typeFutures[i].get();
+                if (!typeReply.is_string())
+                    continue;
+
+                if (typeReply.as_string() == "hash")
+                    hashes.push_back(keys[i]);
+                else if (typeReply.as_string() == "zset" && getPrefix(keys[i], prefix))
+                    prefixPlayers[prefix];
+            }
+
+            std::vector<std::future<cpp_redis::reply> > fieldFutures;
+            for (auto& hash : hashes)
+            {
+                fieldFutures.push_back(client.send({"HKEYS", hash}));
+            }
+            client.sync_commit();
+
+            for (size_t i = 0; i < hashes.size(); i++)
+            {
+                cpp_redis::reply fieldsReply = fieldFutures[i].get();
+                if (!fieldsReply.is_array())
+                    continue;
+
+                for (auto& field : fieldsReply.as_array())
+                {
+                    if (field.is_string() && getPrefix(field.as_string(), prefix))
+                        prefixPlayers[prefix].insert(hashes[i]);
+                }
+            }
+        } while (cursor != "0");
+    }
+
+    const size_t chunkSize = 512;
+    size_t migrated = 0;
+
+    // nickname -> legacy fields of the prefixes that have been copied
+    std::map<std::string, std::vector<std::string> > copiedFields;
+
+    // legacy hash fields and sorted sets: <prefix><key>
+    CKeyTable legacyKeyTable;
+    std::vector<std::pair<std::string, std::string> > pairs;
+
+    // sends the pipelines of the shards at the same time
+    auto commitShards = [this](CShardLeases& leases) {
+        for (size_t i = 0; i < m_Shards.size(); i++)
+        {
+            if (leases.IsLeased(i))
+                leases.Get(i).commit();
+        }
+    };
+
+    for (auto& [prefix, players] : prefixPlayers)
+    {
+        AddKnownPrefix(prefix);
+
+        std::vector<std::string> nicknames(players.begin(), players.end());
+
+        std::vector<std::string> indexBuffer;
+        const std::vector<std::string>& indexKeys = GetIndexKeys(prefix, indexBuffer);
+        const std::vector<std::string>& legacyFieldKeys = legacyKeyTable.Get(prefix);
+
+        for (size_t begin = 0; begin < nicknames.size(); begin += chunkSize)
+        {
+            size_t end = std::min(begin + chunkSize, nicknames.size());
+
+            // players of the chunk that have all stats of this prefix
+            std::vector<std::pair<std::string, CPlayerStats> > chunkPlayers;
+            {
+                CConnectionLease connection(source);
+                cpp_redis::client& client = connection.Get();
+
+                std::vector<std::future<cpp_redis::reply> > getFutures;
+                for (size_t i = begin; i < end; i++)
+                {
+                    getFutures.push_back(client.hmget(nicknames[i], legacyFieldKeys));
+                }
+                client.sync_commit();
+
+                for (size_t i = begin; i < end; i++)
+                {
+                    CPlayerStats stats;
+                    if (!ParseStatsReply(getFutures[i - begin].get(), stats))
+                        continue;
+
+                    chunkPlayers.emplace_back(nicknames[i], stats);
+                }
+            }
+
+            // the players are written to their shards
+            std::vector<size_t> targets(chunkPlayers.size());
+            std::vector<bool> usedShards(m_Shards.size(), false);
+            for (size_t i = 0; i < chunkPlayers.size(); i++)
+            {
+                targets[i] = GetShardIndex(chunkPlayers[i].first, prefix);
+                usedShards[targets[i]] = true;
+            }
+
+            CShardLeases leases(*this, usedShards);
+
+            // players that have been written since an interrupted migration keep their current stats,
+            // the script checks and copies atomically, a concurrent write cannot be overwritten.
+            std::vector<CScriptCall> calls(chunkPlayers.size());
+            std::vector<std::vector<CScriptCall*> > shardCalls(m_Shards.size());
+            for (size_t i = 0; i < chunkPlayers.size(); i++)
+            {
+                auto& [nickname, stats] = chunkPlayers[i];
+                stats.GetStringPairs(pairs);
+
+                CScriptCall& call = calls[i];
+                call.m_pScript = &ms_CopyScript;
+                call.m_Keys.push_back(GetPlayerKey(nickname, prefix));
+                call.m_Args.push_back(nickname);
+                for (size_t field = 0; field < pairs.size(); field++)
+                {
+                    if (!m_IndexedFields[field])
+                        continue;
+
+                    call.m_Keys.push_back(indexKeys[field]);
+                    call.m_Args.push_back(pairs[field].second);
+                }
+                for (auto& [key, value] : pairs)
+                {
+                    call.m_Args.push_back(key);
+                    call.m_Args.push_back(value);
+                }
+
+                EvalScript(leases.Get(targets[i]), call);
+                shardCalls[targets[i]].push_back(&call);
+            }
+            commitShards(leases);
+
+            for (size_t shard = 0; shard < m_Shards.size(); shard++)
+            {
+                if (shardCalls[shard].size() > 0)
+                    GetScriptReplies(leases.Get(shard), shardCalls[shard]);
+            }
+
+            for (size_t i = 0; i < calls.size(); i++)
+            {
+                if (calls[i].m_Reply.is_error())
+                    throw cpp_redis::redis_error("migration failed: " + calls[i].m_Reply.error());
+
+                if (calls[i].m_Reply.is_integer() && calls[i].m_Reply.as_integer() == 1)
+                    migrated++;
+
+                std::vector<std::string>& fields = copiedFields[chunkPlayers[i].first];
+                fields.insert(fields.end(), legacyFieldKeys.begin(), legacyFieldKeys.end());
+            }
+        }
+    }
+
+    // the legacy data is only removed after everything has been copied,
+    // an interrupted migration is started again with the next connection.
+    // only the copied fields are removed, a hash is removed by Redis when its last field is gone.
+    CConnectionLease connection(source);
+    cpp_redis::client& client = connection.Get();
+
+    size_t pending = 0;
+    for (auto& [nickname, fields] : copiedFields)
+    {
+        client.hdel(nickname, fields);
+        if (++pending >= chunkSize)
+        {
+            client.sync_commit();
+            pending = 0;
+        }
+    }
+
+    std::vector<std::string> legacyIndexKeys;
+    for (auto& [prefix, players] : prefixPlayers)
+    {
+        const std::vector<std::string>& keys = legacyKeyTable.Get(prefix);
+        legacyIndexKeys.insert(legacyIndexKeys.end(), keys.begin(), keys.end());
+    }
+
+    for (size_t begin = 0; begin < legacyIndexKeys.size(); begin += chunkSize)
+    {
+        size_t end = std::min(begin + chunkSize, legacyIndexKeys.size());
+        client.del(std::vector<std::string>(legacyIndexKeys.begin() + begin, legacyIndexKeys.begin() + end));
+    }
+
+    std::future<cpp_redis::reply> setFuture = client.send({"SET", ms_LayoutVersionKey, std::to_string(ms_LayoutVersion)});
+    client.sync_commit();
+    setFuture.get();
+
+    std::cout << "[redis]: migrated " << migrated << " rankings of " << prefixPlayers.size() << " prefixes of " << source.m_Host << ":" << source.m_Port
+              << " to key layout version " << ms_LayoutVersion << std::endl;
+}
+
+std::vector<std::string> CRedisRankingServer::ScanPrefixes(cpp_redis::client& client)
+{
+    // every prefix that has players has a sorted set of the ranking key
+    const std::string keyBegin = GetKeyPrefix("").substr(0, GetKeyPrefix("").size() - 2);
+    const std::string keyEnd = "}:idx:" + m_RankingKey;
+    std::vector<std::string> prefixes;
+    std::string cursor = "0";
+    do
+    {
+        std::future<cpp_redis::reply> scanFuture = client.send({"SCAN", cursor, "MATCH", keyBegin + "*" + keyEnd, "COUNT", "1000"});
+        client.sync_commit();
+
+        cpp_redis::reply scanReply = scanFuture.get();
+        if (!scanReply.is_array() || scanReply.as_array().size() != 2 || !scanReply.as_array()[0].is_string() || !scanReply.as_array()[1].is_array())
+            throw cpp_redis::redis_error("SCAN: unexpected reply");
+
+        cursor = scanReply.as_array()[0].as_string();
+        for (auto& key : scanReply.as_array()[1].as_array())
+        {
+            if (key.is_string() && key.as_string().size() >= keyBegin.size() + keyEnd.size())
+                prefixes.push_back(key.as_string().substr(keyBegin.size(), key.as_string().size() - keyBegin.size() - keyEnd.size()));
+        }
+    } while (cursor != "0");
+
+    return prefixes;
+}
+
+void CRedisRankingServer::AddKnownPrefix(const std::string& prefix)
+{
+    std::lock_guard<std::mutex> lock(m_KnownPrefixesMutex);
+    if (m_KnownPrefixes.insert(prefix).second)
+        m_IndexKeys.Get(prefix);
+}
+
+std::vector<std::string> CRedisRankingServer::GetKnownPrefixes()
+{
+    std::lock_guard<std::mutex> lock(m_KnownPrefixesMutex);
+    return std::vector<std::string>(m_KnownPrefixes.begin(), m_KnownPrefixes.end());
+}
+
+void CRedisRankingServer::ReconcileIndices(CShard& shard)
+{
+    std::string indexedKeys;
+    for (auto& key : GetIndexedKeys())
+    {
+        indexedKeys += (indexedKeys.empty() ? "" : ",") + key;
+    }
+
+    CConnectionLease connection(shard);
+    cpp_redis::client& client = connection.Get();
+
+    std::future<cpp_redis::reply> indexedFuture = client.send({"GET", ms_IndexedKeysKey});
+    client.sync_commit();
+
+    cpp_redis::reply indexedReply = indexedFuture.get();
+    if (indexedReply.is_string() && indexedReply.as_string() == indexedKeys)
+        return;
+
+    // unknown(e.g. an older version): the sorted sets of all indexed keys are rebuilt, ZADD does not change existing entries.
+    std::array<bool, CPlayerStats::NUM_FIELDS> wasIndexed;
+    wasIndexed.fill(false);
+    if (indexedReply.is_string())
+    {
+        std::string keys = indexedReply.as_string();
+        for (size_t begin = 0; begin < keys.size();)
+        {
+            size_t end = std::min(keys.find(',', begin), keys.size());
+            int field = CPlayerStats::FieldIndex(keys.substr(begin, end - begin));
+            if (field >= 0)
+                wasIndexed[field] = true;
+            begin = end + 1;
+        }
+    }
+
+    int rankingField = CPlayerStats::FieldIndex(m_RankingKey);
+    std::vector<int> addedFields;
+    for (int field = 0; field < CPlayerStats::NUM_FIELDS; field++)
+    {
+        if (m_IndexedFields[field] && !wasIndexed[field] && field != rankingField)
+            addedFields.push_back(field);
+    }
+
+    std::vector<std::string> prefixes = ScanPrefixes(client);
+
+    const size_t chunkSize = 512;
+    std::vector<std::string> options = {};
+    size_t backfilled = 0;
+
+    for (auto& prefix : prefixes)
+    {
+        std::vector<std::string> indexBuffer;
+        const std::vector<std::string>& indexKeys = GetIndexKeys(prefix, indexBuffer);
+
+        // the sets of a prefix are in the same slot, but they are removed one by one like any other key.
+        for (int field = 0; field < CPlayerStats::NUM_FIELDS; field++)
+        {
+            if (!m_IndexedFields[field])
+                client.send({"UNLINK", indexKeys[field]});
+        }
+        client.sync_commit();
+
+        if (addedFields.empty())
+            continue;
+
+        // the writers are blocked, the ranks of the ranking key's set do not change while it is read in chunks.
+        for (size_t begin = 0;; begin += chunkSize)
+        {
+            std::future<cpp_redis::reply> rangeFuture = client.send({"ZRANGE", indexKeys[rankingField], std::to_string(begin), std::to_string(begin + chunkSize - 1)});
+            client.sync_commit();
+
+            cpp_redis::reply rangeReply = rangeFuture.get();
+            if (!rangeReply.is_array())
+                throw cpp_redis::redis_error("ZRANGE: expected array reply");
+
+            std::vector<std::string> nicknames;
+            for (auto& member : rangeReply.as_array())
+            {
+                if (member.is_string())
+                    nicknames.push_back(member.as_string());
+            }
+
+            std::vector<std::future<cpp_redis::reply> > getFutures;
+            for (auto& nickname : nicknames)
+            {
+                getFutures.push_back(client.hmget(GetPlayerKey(nickname, prefix), CPlayerStats::keys()));
+            }
+            client.sync_commit();
+
+            std::vector<std::future<cpp_redis::reply> > addFutures;
+            for (size_t i = 0; i < nicknames.size(); i++)
+            {
+                CPlayerStats stats;
+                if (!ParseStatsReply(getFutures[i].get(), stats))
+                    continue;
+
+                for (int field : addedFields)
+                {
+                    addFutures.push_back(client.zadd(indexKeys[field], options, {{std::to_string(stats.Get(field)), nicknames[i]}}));
+                }
+                backfilled++;
+            }
+            client.sync_commit();
+
+            for (auto& f : addFutures)
+            {
+                cpp_redis::reply reply = f.get();
+                if (reply.is_error())
+                    throw cpp_redis::redis_error("ZADD: " + reply.error());
+            }
+
+            if (rangeReply.as_array().size() < chunkSize)
+                break;
+        }
+    }
+
+    std::future<cpp_redis::reply> setFuture = client.send({"SET", ms_IndexedKeysKey, indexedKeys});
+    client.sync_commit();
+    setFuture.get();
+
+    std::cout << "[redis]: indexed keys of " << shard.m_Host << ":" << shard.m_Port << " changed to " << indexedKeys << ", "
+              << prefixes.size() << " prefixes, " << backfilled << " players backfilled." << std::endl;
+}
+
+// KEYS[1]: player hash, KEYS[2..n]: sorted sets of the first n - 1 fields.
+// ARGV[1]: nickname, followed by pairs of hash field and the value that is added to it.
+// returns the updated values.
+const std::string CRedisRankingServer::ms_UpdateScript = R"(
+local values = {}
+for i = 2, #ARGV, 2 do
+    local value = redis.call('HINCRBY', KEYS[1], ARGV[i], ARGV[i + 1])
+    local index = KEYS[#values + 2]
+    if index then
+        redis.call('ZADD', index, value, ARGV[1])
+    end
+    values[#values + 1] = value
+end
+return values
+)";
+
+// KEYS[1..n]: sorted sets of the indexed keys, KEYS[n+1..]: player hashes
+// ARGV: nicknames of the player hashes, all players have the same prefix.
+// returns the number of deleted player hashes.
+const std::string CRedisRankingServer::ms_DeleteScript = R"(
+local numIndices = #KEYS - #ARGV
+for i = 1, numIndices do
+    redis.call('ZREM', KEYS[i], unpack(ARGV))
+end
+return redis.call('DEL', unpack(KEYS, numIndices + 1))
+)";
+
+// KEYS[1]: player hash, KEYS[2..n]: sorted sets of the indexed keys
+// ARGV[1]: nickname, ARGV[2..n]: scores of the sorted sets, followed by pairs of hash field and value.
+// returns 0 if the player hash exists already, 1 if it has been copied.
+const std::string CRedisRankingServer::ms_CopyScript = R"(
+if redis.call('EXISTS', KEYS[1]) == 1 then
+    return 0
+end
+local numIndices = #KEYS - 1
+redis.call('HMSET', KEYS[1], unpack(ARGV, numIndices + 2))
+for i = 1, numIndices do
+    redis.call('ZADD', KEYS[i + 1], ARGV[i + 1], ARGV[1])
+end
+return 1
+)";
+
+// KEYS[1]: sorted set of the ranking key
+// ARGV[1]: score, ARGV[2]: nickname, ARGV[3]: '1' if bigger scores are better.
+// returns the number of players that are in front of the player in the merged top ranking:
+// better scores and equal scores with a bigger(ARGV[3] == '1') or smaller nickname.
+const std::string CRedisRankingServer::ms_RankScript = R"(
+local better
+if ARGV[3] == '1' then
+    better = redis.call('ZCOUNT', KEYS[1], '(' .. ARGV[1], '+inf')
+else
+    better = redis.call('ZCOUNT', KEYS[1], '-inf', '(' .. ARGV[1])
+end
+local ties = redis.call('ZCOUNT', KEYS[1], ARGV[1], ARGV[1])
+if ties == 0 then
+    return better
+end
+-- members compare byte-wise like the sorted set does, the Lua operators depend on the locale.
+local function less(a, b)
+    for i = 1, math.min(#a, #b) do
+        local x, y = string.byte(a, i), string.byte(b, i)
+        if x ~= y then
+            return x < y
+        end
+    end
+    return #a < #b
+end
+-- the ties are ordered by ascending nickname, first and count of the ones that are smaller than the nickname.
+local first = redis.call('ZCOUNT', KEYS[1], '-inf', '(' .. ARGV[1])
+local low, high = 0, ties
+while low < high do
+    local mid = math.floor((low + high) / 2)
+    local member = redis.call('ZRANGE', KEYS[1], first + mid, first + mid)[1]
+    if less(member, ARGV[2]) then
+        low = mid + 1
+    else
+        high = mid
+    end
+end
+if ARGV[3] ~= '1' then
+    return better + low
+end
+-- the player is not counted, if it is found on this shard too.
+local smallerOrEqual = low
+if low < ties and redis.call('ZRANGE', KEYS[1], first + low, first + low)[1] == ARGV[2] then
+    smallerOrEqual = low + 1
+end
+return better + ties - smallerOrEqual
+)";
+
+void CRedisRankingServer::LoadScripts(cpp_redis::client& client)
+{
+    std::vector<std::string> scripts = {ms_UpdateScript, ms_DeleteScript, ms_CopyScript, ms_RankScript};
+
+    std::vector<std::future<cpp_redis::reply> > loadFutures;
+    for (auto& script : scripts)
+    {
+        loadFutures.push_back(client.send({"SCRIPT", "LOAD", script}));
+    }
+    client.sync_commit();
+
+    std::lock_guard<std::mutex> lock(m_ScriptMutex);
+    for (size_t i = 0; i < scripts.size(); i++)
+    {
+        cpp_redis::reply reply = loadFutures[i].get();
+        if (reply.is_string() && !reply.is_error())
+        {
+            m_ScriptShas[scripts[i]] = reply.as_string();
+        }
+        else
+        {
+            std::cout << "[redis]: failed to load script: " << reply << std::endl;
+        }
+    }
+}
+
+std::future<cpp_redis::reply> CRedisRankingServer::EvalScript(cpp_redis::client& client, const std::string& script, const std::vector<std::string>& keys, const std::vector<std::string>& args)
+{
+    std::vector<std::string> command;
+    command.reserve(3 + keys.size() + args.size());
+
+    {
+        std::lock_guard<std::mutex> lock(m_ScriptMutex);
+        auto it = m_ScriptShas.find(script);
+        if (it != m_ScriptShas.end())
+        {
+            command.push_back("EVALSHA");
+            command.push_back(it->second);
+        }
+        else
+        {
+            // not loaded yet, EVAL also caches the script on the server.
+            command.push_back("EVAL");
+            command.push_back(script);
+        }
+    }
+
+    command.push_back(std::to_string(keys.size()));
+    command.insert(command.end(), keys.begin(), keys.end());
+    command.insert(command.end(), args.begin(), args.end());
+
+    return client.send(command);
+}
+
+void CRedisRankingServer::EvalScript(cpp_redis::client& client, CScriptCall& call)
+{
+    call.m_Future = EvalScript(client, *call.m_pScript, call.m_Keys, call.m_Args);
+}
+
+void CRedisRankingServer::GetScriptReplies(cpp_redis::client& client, const std::vector<CScriptCall*>& calls)
+{
+    std::vector<CScriptCall*> missingScripts;
+    for (CScriptCall* pCall : calls)
+    {
+        pCall->m_Reply = pCall->m_Future.get();
+        if (pCall->m_Reply.is_error() && pCall->m_Reply.error().compare(0, 8, "NOSCRIPT") == 0)
+            missingScripts.push_back(pCall);
+    }
+
+    if (missingScripts.size() == 0)
+        return;
+
+    // the server's script cache has been flushed(e.g. server restart), the scripts are loaded again.
+    // the calls fall back to EVAL, if a script cannot be loaded.
+    {
+        std::lock_guard<std::mutex> lock(m_ScriptMutex);
+        for (CScriptCall* pCall : missingScripts)
+        {
+            m_ScriptShas.erase(*pCall->m_pScript);
+        }
+    }
+    LoadScripts(client);
+
+    for (CScriptCall* pCall : missingScripts)
+    {
+        EvalScript(client, *pCall);
+    }
+    client.sync_commit();
+
+    for (CScriptCall* pCall : missingScripts)
+    {
+        pCall->m_Reply = pCall->m_Future.get();
+    }
+}
+
+void CRedisRankingServer::GetUpdateScriptArgs(const std::string& nickname, const CPlayerStats& stats, const std::string& prefix, std::vector<std::string>& keys, std::vector<std::string>& args) const
+{
+    const std::vector<std::string>& fields = CPlayerStats::keys();
+    std::vector<std::string> indexBuffer;
+    const std::vector<std::string>& indexKeys = GetIndexKeys(prefix, indexBuffer);
+    CPlayerStats::format_buffer_t buffer;
+
+    keys.reserve(1 + fields.size());
+    args.reserve(1 + 2 * fields.size());
+
+    keys.push_back(GetPlayerKey(nickname, prefix));
+    args.push_back(nickname);
+
+    // the indexed fields come first, their sorted sets are passed as keys.
+    for (bool indexed : {true, false})
+    {
+        for (size_t i = 0; i < fields.size(); i++)
+        {
+            if (m_IndexedFields[i] != indexed)
+                continue;
+
+            if (indexed)
+                keys.push_back(indexKeys[i]);
+
+            args.push_back(fields[i]);
+            args.emplace_back(CPlayerStats::FormatValue(stats.Get(i), buffer));
+        }
+    }
+}
+
+void CRedisRankingServer::GetDeleteScriptArgs(const std::vector<std::string>& nicknames, const std::string& prefix, std::vector<std::string>& keys, std::vector<std::string>& args) const
+{
+    std::vector<std::string> indexBuffer;
+    const std::vector<std::string>& indexKeys = GetIndexKeys(prefix, indexBuffer);
+
+    keys.reserve(indexKeys.size() + nicknames.size());
+    args.reserve(nicknames.size());
+
+    for (size_t i = 0; i < indexKeys.size(); i++)
+    {
+        if (m_IndexedFields[i])
+            keys.push_back(indexKeys[i]);
+    }
+
+    for (auto& nickname : nicknames)
+    {
+        keys.push_back(GetPlayerKey(nickname, prefix));
+        args.push_back(nickname);
+    }
+}
+
+bool CRedisRankingServer::ParseStatsReply(const cpp_redis::reply& reply, CPlayerStats& stats)
+{
+    if (!reply.is_array())
+    {
+        stats.Invalidate();
+        return false;
+    }
+
+    const std::vector<cpp_redis::reply>& result = reply.as_array();
+
+    // set every key.
+    for (size_t idx = 0; idx < stats.size(); idx++)
+    {
+        if (idx >= result.size() || result.at(idx).is_null())
+        {
+            // result is null
+            // key not found
+            stats.Invalidate();
+            return false; // entry does not exist yet.
+        }
+        else if (result.at(idx).is_string() && CPlayerStats::ParseValue(result.at(idx).as_string(), stats.Get(idx)))
+        {
+            // parsed without allocating
+        }
+        else if (result.at(idx).is_integer())
+        {
+            stats.Get(idx) = result.at(idx).as_integer();
+        }
+        else
+        {
+            std::cout << "[redis_error]: unkown result type" << std::endl;
+            stats.Invalidate();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool CRedisRankingServer::ParseUpdateReply(const cpp_redis::reply& reply, CPlayerStats& total) const
+{
+    if (!reply.is_array() || reply.as_array().size() != CPlayerStats::NUM_FIELDS)
+    {
+        total.Invalidate();
+        return false;
+    }
+
+    // the indexed fields come first, like in GetUpdateScriptArgs()
+    const std::vector<cpp_redis::reply>& values = reply.as_array();
+    size_t pos = 0;
+    for (bool indexed : {true, false})
+    {
+        for (int field = 0; field < CPlayerStats::NUM_FIELDS; field++)
+        {
+            if (m_IndexedFields[field] != indexed)
+                continue;
+
+            const cpp_redis::reply& value = values[pos++];
+            if (!value.is_integer())
+            {
+                total.Invalidate();
+                return false;
+            }
+            total.Get(field) = static_cast<int>(value.as_integer());
+        }
+    }
+    return true;
+}
+
+IRankingServer::key_stats_vec_t CRedisRankingServer::GetTopRankingSync(int topNumber, std::string key, std::string prefix, bool biggestFirst)
+{
+    IRankingServer::key_stats_vec_t sortedResult;
+
+    int field = CPlayerStats::FieldIndex(key);
+    if (field < 0)
+        throw std::invalid_argument("Invalid key: " + key);
+
+    if (topNumber <= 0)
+        return sortedResult;
+
+    std::string indexBuffer;
+    const std::string& index = GetIndexKey(prefix, field, indexBuffer);
+
+    // the connections of the available shards are used exclusively until the function returns,
+    // the players of the other shards are missing from the result.
+    std::vector<bool> usedShards(m_Shards.size(), false);
+    for (size_t i = 0; i < m_Shards.size(); i++)
+    {
+        usedShards[i] = IsAvailable(*m_Shards[i]);
+    }
+    CShardLeases leases(*this, usedShards);
+    std::vector<bool> failedShards(m_Shards.size(), false);
+
+    // a shard that loses its connection is skipped, other errors are propagated to the calling function.
+    auto handleShardError = [this, &leases, &failedShards](size_t shard, const cpp_redis::redis_error& e) {
+        if (leases.Get(shard).is_connected())
+            throw;
+
+        failedShards[shard] = true;
+        HandleConnectionErrors(leases, e);
+    };
+
+    // the top x of every shard are requested at the same time.
+    // rank based range, scores can be negative.
+    std::vector<std::future<cpp_redis::reply> > rangeFutures(m_Shards.size());
+    for (size_t i = 0; i < m_Shards.size(); i++)
+    {
+        if (usedShards[i])
+            rangeFutures[i] = leases.Get(i).send({biggestFirst ? "ZREVRANGE" : "ZRANGE", index, "0", std::to_string(topNumber - 1), "WITHSCORES"});
+    }
+    CommitShards(leases, usedShards, failedShards);
+
+    // nickname, score of every shard in the order of the shard
+    std::vector<std::vector<std::pair<std::string, int> > > shardRanges(m_Shards.size());
+    for (size_t i = 0; i < m_Shards.size(); i++)
+    {
+        if (!usedShards[i] || failedShards[i])
+            continue;
+
+        try
+        {
+            cpp_redis::reply result = rangeFutures[i].get();
+
+            if (!result.is_array())
+            {
+                throw cpp_redis::redis_error("Expected array return value of z[rev]range(...)");
+            }
+
+            // [member, score, member, score, ...]
+            const std::vector<cpp_redis::reply>& members = result.as_array();
+            shardRanges[i].reserve(members.size() / 2);
+
+            for (size_t m = 0; m + 1 < members.size(); m += 2)
+            {
+                if (!members[m].is_string() || !members[m + 1].is_string())
+                {
+                    throw cpp_redis::redis_error("Expected string as nickname and score.");
+                }
+
+                shardRanges[i].emplace_back(members[m].as_string(), static_cast<int>(std::stod(members[m + 1].as_string())));
+            }
+        }
+        catch (const cpp_redis::redis_error& e)
+        {
+            shardRanges[i].clear();
+            handleShardError(i, e);
+        }
+    }
+
+    // k-way merge of the ranges, equal scores are ordered by nickname like redis orders them.
+    // shard, position in its range
+    using head_t = std::pair<size_t, size_t>;
+    auto isBehind = [&shardRanges, biggestFirst](const head_t& a, const head_t& b) {
+        auto& [nicknameA, scoreA] = shardRanges[a.first][a.second];
+        auto& [nicknameB, scoreB] = shardRanges[b.first][b.second];
+        if (scoreA != scoreB)
+            return biggestFirst ? scoreA < scoreB : scoreA > scoreB;
+        return biggestFirst ? nicknameA < nicknameB : nicknameA > nicknameB;
+    };
+
+    std::priority_queue<head_t, std::vector<head_t>, decltype(isBehind)> heads(isBehind);
+    for (size_t i = 0; i < m_Shards.size(); i++)
+    {
+        if (shardRanges[i].size() > 0)
+            heads.push({i, 0});
+    }
+
+    std::vector<size_t> shards;
+    std::vector<int> scores;
+    while (heads.size() > 0 && sortedResult.size() < static_cast<size_t>(topNumber))
+    {
+        auto [shard, pos] = heads.top();
+        heads.pop();
+
+        sortedResult.push_back({shardRanges[shard][pos].first, {/* empty*/}});
+        scores.push_back(shardRanges[shard][pos].second);
+        shards.push_back(shard);
+
+        if (pos + 1 < shardRanges[shard].size())
+            heads.push({shard, pos + 1});
+    }
+
+    if (sortedResult.size() == 0)
+        return sortedResult;
+
+    // the player stats are retrieved from their shards at the same time, one pipeline per shard
+    std::vector<std::future<cpp_redis::reply> > getFutures;
+    std::vector<bool> statsShards(m_Shards.size(), false);
+    getFutures.reserve(sortedResult.size());
+    for (size_t i = 0; i < sortedResult.size(); i++)
+    {
+        getFutures.push_back(leases.Get(shards[i]).hmget(GetPlayerKey(sortedResult[i].first, prefix), CPlayerStats::keys()));
+        statsShards[shards[i]] = true;
+    }
+    CommitShards(leases, statsShards, failedShards);
+
+    for (size_t i = 0; i < sortedResult.size(); i++)
+    {
+        if (failedShards[shards[i]])
+            continue;
+
+        CPlayerStats& stats = sortedResult[i].second;
+        try
+        {
+            if (ParseStatsReply(getFutures[i].get(), stats))
+            {
+                // the index is the source of the ranking
+                stats[key] = scores[i];
+            }
+        }
+        catch (const cpp_redis::redis_error& e)
+        {
+            handleShardError(shards[i], e);
+        }
+    }
+
+    // the players of shards that have failed in between are removed,
+    // the position in the range is the rank in this index.
+    IRankingServer::key_stats_vec_t reachableResult;
+    reachableResult.reserve(sortedResult.size());
+    for (size_t i = 0; i < sortedResult.size(); i++)
+    {
+        if (failedShards[shards[i]])
+            continue;
+
+        reachableResult.push_back(std::move(sortedResult[i]));
+        reachableResult.back().second.SetRank(reachableResult.size());
+    }
+
+    return reachableResult;
+}
+
+CPlayerStats CRedisRankingServer::UpdateRankingSync(std::string nickname, CPlayerStats stats, std::string prefix)
+{
+    AddKnownPrefix(prefix);
+
+    // the connection is used exclusively until the function returns
+    CShard& shard = GetShard(nickname, prefix);
+    CConnectionLease connection(shard);
+    cpp_redis::client& client = connection.Get();
+
+    try
+    {
+        // the increments and the index updates are applied atomically by the server in one round trip.
+        CScriptCall call;
+        call.m_pScript = &ms_UpdateScript;
+        GetUpdateScriptArgs(nickname, stats, prefix, call.m_Keys, call.m_Args);
+
+        EvalScript(client, call);
+        client.sync_commit();
+
+        GetScriptReplies(client, {&call});
+        if (call.m_Reply.is_error())
+        {
+            throw cpp_redis::redis_error(call.m_Reply.error());
+        }
+
+        CPlayerStats total;
+        ParseUpdateReply(call.m_Reply, total);
+        return total;
+    }
+    catch (const cpp_redis::redis_error& e)
+    {
+        if (!client.is_connected())
+        {
+            std::cout << "[redis]: lost connection to " << shard.m_Host << ":" << shard.m_Port << ": " << e.what() << std::endl;
+            StartReconnectHandler(shard);
+        }
+        else if (!IsValidNickname(nickname))
+        {
+            std::cout << "invalid nickname: " << nickname << std::endl;
+            stats.Invalidate();
+            return stats;
+        }
+        else
+        {
+            // invalid player nick retrieved.
+            // don't do anything then.
+        }
+        throw;
+    }
+}
+
+void CRedisRankingServer::SetRankingSync(std::string nickname, CPlayerStats stats, std::string prefix)
+{
+    AddKnownPrefix(prefix);
+
+    // the connection is used exclusively until the function returns
+    CShard& shard = GetShard(nickname, prefix);
+    CConnectionLease connection(shard);
+    cpp_redis::client& client = connection.Get();
+
+    try
+    {
+        std::vector<std::pair<std::string, std::string> > pairs;
+        stats.GetStringPairs(pairs);
+        std::future<cpp_redis::reply> setFuture = client.hmset(GetPlayerKey(nickname, prefix), pairs);
+
+        // create/update index for every indexed key
+        std::vector<std::string> options = {};
+        std::vector<std::future<cpp_redis::reply> > indexFutures;
+        std::vector<std::string> indexBuffer;
+        const std::vector<std::string>& indexKeys = GetIndexKeys(prefix, indexBuffer);
+        CPlayerStats::format_buffer_t buffer;
+        for (size_t i = 0; i < indexKeys.size(); i++)
+        {
+            if (!m_IndexedFields[i])
+                continue;
+
+            indexFutures.push_back(
+                client.zadd(indexKeys[i],
+                              options,
+                              {{std::string(CPlayerStats::FormatValue(stats.Get(i), buffer)), nickname}}));
+        }
+
+        client.sync_commit();
+        for (auto& f : indexFutures)
+        {
+            cpp_redis::reply r = f.get();
+            // retrieve results
+            // don't do anything with it.
+        }
+    }
+    catch (const cpp_redis::redis_error& e)
+    {
+        if (!client.is_connected())
+        {
+            std::cout << "[redis]: lost connection to " << shard.m_Host << ":" << shard.m_Port << ": " << e.what() << std::endl;
+            StartReconnectHandler(shard);
+        }
+        else if (!IsValidNickname(nickname))
+        {
+            std::cout << "invalid nickname: " << nickname << std::endl;
+            return;
+        }
+        else
+        {
+            // unexpected error
+        }
+        // rethrow in order to handle backlog stuff.
+        throw;
+    }
+}
+
+void CRedisRankingServer::CommitShards(CShardLeases& leases, const std::vector<bool>& usedShards, std::vector<bool>& failedShards)
+{
+    for (size_t i = 0; i < m_Shards.size(); i++)
+    {
+        if (!usedShards[i])
+            continue;
+
+        try
+        {
+            leases.Get(i).commit();
+        }
+        catch (const cpp_redis::redis_error& e)
+        {
+            failedShards[i] = true;
+            HandleConnectionErrors(leases, e);
+        }
+    }
+}
+
+std::vector<bool> CRedisRankingServer::UpdateRankingBatchSync(const IRankingServer::ranking_batch_t& batch, std::vector<CPlayerStats>& totals)
+{
+    std::vector<bool> status(batch.size(), false);
+    totals.assign(batch.size(), CPlayerStats());
+
+    std::vector<size_t> entryShards(batch.size());
+    std::vector<bool> usedShards(m_Shards.size(), false);
+    for (size_t i = 0; i < batch.size(); i++)
+    {
+        entryShards[i] = GetShardIndex(std::get<0>(batch[i]), std::get<2>(batch[i]));
+        usedShards[entryShards[i]] = true;
+        AddKnownPrefix(std::get<2>(batch[i]));
+    }
+
+    // the connections are used exclusively until the function returns
+    CShardLeases leases(*this, usedShards);
+    std::vector<bool> failedShards(m_Shards.size(), false);
+
+    // one script call per player, the calls of a shard are sent in a single pipeline
+    std::vector<CScriptCall> calls(batch.size());
+    std::vector<std::vector<CScriptCall*> > shardCalls(m_Shards.size());
+
+    for (size_t i = 0; i < batch.size(); i++)
+    {
+        auto& [nickname, stats, prefix] = batch[i];
+        calls[i].m_pScript = &ms_UpdateScript;
+        GetUpdateScriptArgs(nickname, stats, prefix, calls[i].m_Keys, calls[i].m_Args);
+        EvalScript(leases.Get(entryShards[i]), calls[i]);
+        shardCalls[entryShards[i]].push_back(&calls[i]);
+    }
+    CommitShards(leases, usedShards, failedShards);
+
+    for (size_t shard = 0; shard < m_Shards.size(); shard++)
+    {
+        if (!usedShards[shard] || failedShards[shard])
+            continue;
+
+        try
+        {
+            GetScriptReplies(leases.Get(shard), shardCalls[shard]);
+        }
+        catch (const cpp_redis::redis_error& e)
+        {
+            failedShards[shard] = true;
+            HandleConnectionErrors(leases, e);
+        }
+    }
+
+    for (size_t i = 0; i < batch.size(); i++)
+    {
+        status[i] = !failedShards[entryShards[i]] && !calls[i].m_Reply.is_error();
+        if (!status[i] || !ParseUpdateReply(calls[i].m_Reply, totals[i]))
+            totals[i].Invalidate();
+    }
+    return status;
+}
+
+std::vector<bool> CRedisRankingServer::SetRankingBatchSync(const IRankingServer::ranking_batch_t& batch)
+{
+    std::vector<bool> status(batch.size(), false);
+
+    // the entries of a prefix are written in a single transaction, as a cluster only executes
+    // transactions whose keys are in the same slot. the transactions of a shard are sent in one pipeline.
+    std::vector<std::map<std::string, std::vector<size_t> > > shardEntries(m_Shards.size());
+    std::vector<bool> usedShards(m_Shards.size(), false);
+    for (size_t i = 0; i < batch.size(); i++)
+    {
+        auto& [nickname, stats, prefix] = batch[i];
+        size_t shard = GetShardIndex(nickname, prefix);
+        shardEntries[shard][prefix].push_back(i);
+        usedShards[shard] = true;
+        AddKnownPrefix(prefix);
+    }
+
+    // the connections are used exclusively until the function returns
+    CShardLeases leases(*this, usedShards);
+    std::vector<bool> failedShards(m_Shards.size(), false);
+
+    std::vector<std::string> options = {};
+    size_t numIndexed = GetIndexedKeys().size();
+    std::vector<std::vector<std::future<cpp_redis::reply> > > execFutures(m_Shards.size());
+
+    // the commands are built when they are queued, the strings are reused for every entry.
+    std::vector<std::pair<std::string, std::string> > pairs;
+
+    for (size_t shard = 0; shard < m_Shards.size(); shard++)
+    {
+        if (!usedShards[shard])
+            continue;
+
+        cpp_redis::client& client = leases.Get(shard);
+        for (auto& [prefix, entries] : shardEntries[shard])
+        {
+            std::vector<std::string> indexBuffer;
+            const std::vector<std::string>& indexKeys = GetIndexKeys(prefix, indexBuffer);
+
+            client.send({"MULTI"});
+            for (size_t i : entries)
+            {
+                auto& [nickname, stats, entryPrefix] = batch[i];
+                stats.GetStringPairs(pairs);
+                client.hmset(GetPlayerKey(nickname, prefix), pairs);
+
+                // create/update index for every indexed key
+                for (size_t field = 0; field < pairs.size(); field++)
+                {
+                    if (m_IndexedFields[field])
+                        client.zadd(indexKeys[field], options, {{pairs[field].second, nickname}});
+                }
+            }
+            execFutures[shard].push_back(client.send({"EXEC"}));
+        }
+    }
+    CommitShards(leases, usedShards, failedShards);
+
+    for (size_t shard = 0; shard < m_Shards.size(); shard++)
+    {
+        if (!usedShards[shard] || failedShards[shard])
+            continue;
+
+        try
+        {
+            size_t transaction = 0;
+            for (auto& [prefix, entries] : shardEntries[shard])
+            {
+                cpp_redis::reply execReply = execFutures[shard][transaction++].get();
+                if (!execReply.is_array())
+                    continue; // the entries of this prefix failed
+
+                // every entry has one HMSET reply followed by one ZADD reply per indexed key.
+                const std::vector<cpp_redis::reply>& results = execReply.as_array();
+                size_t pos = 0;
+                for (size_t i : entries)
+                {
+                    size_t numReplies = 1 + numIndexed;
+
+                    bool ok = pos + numReplies <= results.size();
+                    for (size_t r = pos; ok && r < pos + numReplies; r++)
+                    {
+                        ok = !results[r].is_error();
+                    }
+
+                    status[i] = ok;
+                    pos += numReplies;
+                }
+            }
+        }
+        catch (const cpp_redis::redis_error& e)
+        {
+            failedShards[shard] = true;
+            HandleConnectionErrors(leases, e);
+        }
+    }
+    return status;
+}
+
+void CRedisRankingServer::DeleteRankingSync(std::string nickname, std::string prefix)
+{
+    // the connection is used exclusively until the function returns
+    CShard& shard = GetShard(nickname, prefix);
+    CConnectionLease connection(shard);
+    cpp_redis::client& client = connection.Get();
+
+    try
+    {
+        // the hash and the index entries are deleted atomically by the server in one round trip,
+        // the player's hash only contains the stats of this prefix.
+        CScriptCall call;
+        call.m_pScript = &ms_DeleteScript;
+        GetDeleteScriptArgs({nickname}, prefix, call.m_Keys, call.m_Args);
+
+        EvalScript(client, call);
+        client.sync_commit();
+
+        GetScriptReplies(client, {&call});
+        if (!call.m_Reply.is_integer())
+        {
+            throw cpp_redis::redis_error(call.m_Reply.is_error() ? call.m_Reply.error() : "deletion failed");
+        }
+    }
+    catch (const cpp_redis::redis_error& e)
+    {
+        if (!client.is_connected())
+        {
+            std::cout << "[redis]: lost connection to " << shard.m_Host << ":" << shard.m_Port << ": " << e.what() << std::endl;
+            StartReconnectHandler(shard);
+        }
+
+        // like a failed entry of DeleteRankingBatchSync, the deletion is not reported as written.
+        throw;
+    }
+}
+
+std::vector<bool> CRedisRankingServer::DeleteRankingBatchSync(const IRankingServer::delete_batch_t& batch)
+{
+    std::vector<bool> status(batch.size(), false);
+
+    // the players of a prefix are deleted by one script call, the keys of a call are in the same cluster slot.
+    // the calls are split, so that a single call does not block the server for long.
+    const size_t chunkSize = 512;
+
+    // shard -> prefix -> entries
+    std::vector<std::map<std::string, std::vector<size_t> > > shardEntries(m_Shards.size());
+    std::vector<bool> usedShards(m_Shards.size(), false);
+    for (size_t i = 0; i < batch.size(); i++)
+    {
+        auto& [nickname, prefix] = batch[i];
+        size_t shard = GetShardIndex(nickname, prefix);
+        shardEntries[shard][prefix].push_back(i);
+        usedShards[shard] = true;
+    }
+
+    // the connections are used exclusively until the function returns
+    CShardLeases leases(*this, usedShards);
+    std::vector<bool> failedShards(m_Shards.size(), false);
+
+    // one script call per chunk, the calls of a shard are sent in a single pipeline
+    struct CDeleteCall
+    {
+        size_t m_Shard;
+        std::vector<size_t> m_Entries;
+        CScriptCall m_Call;
+    };
+    std::vector<CDeleteCall> calls;
+
+    for (size_t shard = 0; shard < m_Shards.size(); shard++)
+    {
+        for (auto& [prefix, entries] : shardEntries[shard])
+        {
+            for (size_t begin = 0; begin < entries.size(); begin += chunkSize)
+            {
+                CDeleteCall call;
+                call.m_Shard = shard;
+                call.m_Entries.assign(entries.begin() + begin, entries.begin() + std::min(begin + chunkSize, entries.size()));
+
+                std::vector<std::string> nicknames;
+                nicknames.reserve(call.m_Entries.size());
+                for (size_t i : call.m_Entries)
+                {
+                    nicknames.push_back(batch[i].first);
+                }
+
+                call.m_Call.m_pScript = &ms_DeleteScript;
+                GetDeleteScriptArgs(nicknames, prefix, call.m_Call.m_Keys, call.m_Call.m_Args);
+                EvalScript(leases.Get(shard), call.m_Call);
+                calls.push_back(std::move(call));
+            }
+        }
+    }
+    CommitShards(leases, usedShards, failedShards);
+
+    for (size_t shard = 0; shard < m_Shards.size(); shard++)
+    {
+        if (!usedShards[shard] || failedShards[shard])
+            continue;
+
+        std::vector<CScriptCall*> shardCalls;
+        for (auto& call : calls)
+        {
+            if (call.m_Shard == shard)
+                shardCalls.push_back(&call.m_Call);
+        }
+
+        try
+        {
+            GetScriptReplies(leases.Get(shard), shardCalls);
+        }
+        catch (const cpp_redis::redis_error& e)
+        {
+            failedShards[shard] = true;
+            HandleConnectionErrors(leases, e);
+        }
+    }
+
+    for (auto& call : calls)
+    {
+        if (failedShards[call.m_Shard])
+            continue;
+
+        if (call.m_Call.m_Reply.is_error())
+        {
+            std::cout << "[redis] unexpected error while trying to delete entries: " << call.m_Call.m_Reply.error() << std::endl;
+            continue;
+        }
+
+        for (size_t i : call.m_Entries)
+        {
+            status[i] = true;
+        }
+    }
+    return status;
+}
+
+namespace
+{
+    // cached statements need to be reset after their execution,
+    // otherwise they keep their bindings and their read lock on the database.
+    class CStatementResetGuard
+    {
+        SQLite::Statement& m_Statement;
+
+       public:
+        explicit CStatementResetGuard(SQLite::Statement& statement) : m_Statement{statement} {}
+        ~CStatementResetGuard()
+        {
+            try
+            {
+                m_Statement.reset();
+                m_Statement.clearBindings();
+            }
+            catch (const SQLite::Exception& e)
+            {
+                // the error has already been reported by the failed execution.
+            }
+        }
+    };
+} // namespace
+
+CSQLiteRankingServer::CSQLiteRankingServer()
+{
+    m_DefaultConstructed = true;
+    m_Writer.m_pDatabase = nullptr;
+}
+
+void CSQLiteRankingServer::FixPrefix(std::string& prefix)
+{
+    // replace whitespace with underscore
+    std::transform(prefix.begin(), prefix.end(), prefix.begin(), [](unsigned char ch) {
+        return std::isspace(static_cast<unsigned char>(ch)) ? '_' : ch;
+    });
+
+    // prefix must not start with an intger, cuz it's an invalid table name then
+    if (prefix.size() > 0 && std::isdigit(prefix[0]))
+    {
+        prefix = std::string("_") + prefix;
+    }
+}
+
+std::vector<std::string> CSQLiteRankingServer::GetKnownPrefixes()
+{
+    std::lock_guard<std::mutex> lock(m_ValidPrefixListMutex);
+    return m_ValidPrefixList;
+}
+
+std::string CSQLiteRankingServer::NormalizePrefix(const std::string& prefix)
+{
+    std::string fixed = prefix;
+    FixPrefix(fixed);
+    return fixed;
+}
+
+bool CSQLiteRankingServer::HasUncommittedWrites()
+{
+    return m_InTransaction;
+}
+
+CSQLiteRankingServer::CSQLiteRankingServer(std::string filePath, std::vector<std::string> validPrefixList, int busyTimeoutMs, size_t numWorkers, size_t maxQueuedJobs, CSQLiteSettings settings) : m_Settings{settings}
+{
+    m_DefaultConstructed = false;
+    m_Writer.m_pDatabase = nullptr;
+
+    m_ValidPrefixList.reserve(validPrefixList.size());
+
+    for (auto& prefix : validPrefixList)
     {
         FixPrefix(prefix);
 
-        m_ValidPrefixList.push_back(prefix);
+        m_ValidPrefixList.push_back(prefix);
+    }
+
+    SetIndexedKeys(m_Settings.m_IndexedKeys);
+
+    const std::vector<std::string>& Columns = CPlayerStats::keys();
+    size_t ColumnsSize = Columns.size();
+
+    // used to consruct creation query
+    std::stringstream ss;
+
+    for (auto& p : m_ValidPrefixList)
+    {
+        // create table for every prefix
+        std::string TableName = p + m_BaseTableName;
+
+        ss << "CREATE TABLE IF NOT EXISTS " << TableName << "  ( ";
+        ss << "Key TEXT PRIMARY KEY ASC,\n";
+
+        for (size_t i = 0; i < ColumnsSize; i++)
+        {
+            ss << " " << Columns[i] << " UNSIGNED INTEGER DEFAULT 0";
+
+            if (i < ColumnsSize - 1)
+                ss << " ,\n";
+        }
+        ss << " );\n";
+
+        // create indices, the indices of keys that are not indexed anymore are dropped,
+        // otherwise they would still be updated by every write.
+        // the ranking key is covered by the composite index below, a separate index would only slow down the writes.
+        for (size_t i = 0; i < ColumnsSize; i++)
+        {
+            if (m_IndexedFields[i] && Columns[i] != m_RankingKey)
+                ss << "CREATE INDEX IF NOT EXISTS " << TableName << "_" << Columns[i] << "_index ON " << TableName << " (" << Columns[i] << ");\n";
+            else
+                ss << "DROP INDEX IF EXISTS " << TableName << "_" << Columns[i] << "_index;\n";
+        }
+
+        // rank lookups count the players in front of a player with this index
+        ss << "CREATE INDEX IF NOT EXISTS " << TableName << "_" << m_RankingKey << "_Key_index ON " << TableName << " (" << m_RankingKey << ", Key);\n";
     }
 
-    std::vector<std::string> Columns = stats.keys();
-    size_t ColumnsSize = Columns.size();
+    try
+    {
+        m_FilePath = filePath;
+        m_Writer.m_pDatabase = new SQLite::Database(m_FilePath, SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE);
+        m_Writer.m_pDatabase->setBusyTimeout(busyTimeoutMs);
+        ApplySettings();
+        m_Writer.m_pDatabase->exec(ss.str());
+
+        // every statement is prepared once per table
+        for (auto& p : m_ValidPrefixList)
+        {
+            PrepareStatements(m_Writer, p);
+        }
+
+        OpenReaders(busyTimeoutMs);
+
+        std::cout << "[SQLite]: Successfully created database: '" << m_FilePath << "'" << std::endl;
+
+        m_WorkerPool.Start(numWorkers, maxQueuedJobs);
+
+        if (m_Settings.m_GroupCommitIntervalMs > 0)
+        {
+            m_GroupCommitThread = std::thread(&CSQLiteRankingServer::HandleGroupCommit, this);
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << "[SQLite] failed to create a database: " << e.what() << '\n';
+
+        // got an error opening db
+        // no sense in trying again
+        m_DefaultConstructed = true;
+        CloseReaders();
+        m_Writer.m_Statements.clear();
+
+        if (m_Writer.m_pDatabase)
+        {
+            delete m_Writer.m_pDatabase;
+            m_Writer.m_pDatabase = nullptr;
+        }
+    }
+}
+
+CSQLiteRankingServer::~CSQLiteRankingServer()
+{
+    StopWorkers();
+
+    if (m_GroupCommitThread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_GroupCommitMutex);
+            m_StopGroupCommit = true;
+        }
+        m_GroupCommitCondition.notify_all();
+        m_GroupCommitThread.join();
+    }
+
+    if (m_Writer.m_pDatabase)
+    {
+        // writes of the last time window
+        std::lock_guard<std::mutex> lock(m_DatabaseMutex);
+        CommitWrites();
+    }
+
+    CloseReaders();
+
+    // statements need to be finalized before the database is closed
+    m_Writer.m_Statements.clear();
+
+    if (m_Writer.m_pDatabase)
+    {
+        delete m_Writer.m_pDatabase;
+        m_Writer.m_pDatabase = nullptr;
+    }
+}
+
+void CSQLiteRankingServer::OpenReaders(int busyTimeoutMs)
+{
+    // other journal modes block readers while writing, there is nothing to gain.
+    std::string journalMode = m_Settings.m_JournalMode;
+    std::transform(journalMode.begin(), journalMode.end(), journalMode.begin(), [](unsigned char ch) { return std::toupper(ch); });
+    if (journalMode != "WAL")
+        return;
+
+    std::stringstream ss;
+    ss << "PRAGMA cache_size = " << m_Settings.m_CacheSize << ";\n";
+    ss << "PRAGMA mmap_size = " << m_Settings.m_MmapSize << ";\n";
+
+    std::lock_guard<std::mutex> lock(m_ReadersMutex);
+    for (size_t i = 0; i < m_Settings.m_NumReaders; i++)
+    {
+        auto reader = std::make_unique<CConnection>();
+        reader->m_pDatabase = new SQLite::Database(m_FilePath, SQLite::OPEN_READONLY);
+
+        try
+        {
+            reader->m_pDatabase->setBusyTimeout(busyTimeoutMs);
+            reader->m_pDatabase->exec(ss.str());
+
+            for (auto& p : m_ValidPrefixList)
+            {
+                PrepareStatements(*reader, p, true);
+            }
+        }
+        catch (const SQLite::Exception& e)
+        {
+            reader->m_Statements.clear();
+            delete reader->m_pDatabase;
+            throw;
+        }
+
+        m_FreeReaders.push_back(reader.get());
+        m_Readers.push_back(std::move(reader));
+    }
+}
+
+void CSQLiteRankingServer::CloseReaders()
+{
+    std::lock_guard<std::mutex> lock(m_ReadersMutex);
+    for (auto& reader : m_Readers)
+    {
+        reader->m_Statements.clear();
+        delete reader->m_pDatabase;
+        reader->m_pDatabase = nullptr;
+    }
+    m_FreeReaders.clear();
+    m_Readers.clear();
+}
+
+CSQLiteRankingServer::CReaderLease::CReaderLease(CSQLiteRankingServer& server) : m_Server{server}, m_pConnection{nullptr}
+{
+    std::unique_lock<std::mutex> lock(m_Server.m_ReadersMutex);
+    if (m_Server.m_Readers.empty())
+    {
+        lock.unlock();
+        m_WriterLock = std::unique_lock<std::mutex>(m_Server.m_DatabaseMutex);
+        m_pConnection = &m_Server.m_Writer;
+        return;
+    }
+
+    m_Server.m_ReadersCondition.wait(lock, [this]() { return !m_Server.m_FreeReaders.empty(); });
+    m_pConnection = m_Server.m_FreeReaders.back();
+    m_Server.m_FreeReaders.pop_back();
+}
+
+CSQLiteRankingServer::CReaderLease::~CReaderLease()
+{
+    if (m_WriterLock.owns_lock())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(m_Server.m_ReadersMutex);
+        m_Server.m_FreeReaders.push_back(m_pConnection);
+    }
+    m_Server.m_ReadersCondition.notify_one();
+}
+
+std::unique_lock<std::mutex> CSQLiteRankingServer::LockForReading()
+{
+    // GetRankingSync and GetTopRankingSync lease a connection(see CReaderLease).
+    return std::unique_lock<std::mutex>();
+}
+
+void CSQLiteRankingServer::ApplySettings()
+{
+    // pragma values cannot be bound, only allow plain words.
+    auto isWord = [](const std::string& value) {
+        return value.size() > 0 && std::all_of(value.begin(), value.end(), [](unsigned char ch) { return std::isalnum(ch); });
+    };
 
-    // used to consruct creation query
     std::stringstream ss;
 
+    if (isWord(m_Settings.m_JournalMode))
+        ss << "PRAGMA journal_mode = " << m_Settings.m_JournalMode << ";\n";
+    else
+        std::cout << "[SQLite] invalid journal mode: '" << m_Settings.m_JournalMode << "'" << std::endl;
+
+    if (isWord(m_Settings.m_Synchronous))
+        ss << "PRAGMA synchronous = " << m_Settings.m_Synchronous << ";\n";
+    else
+        std::cout << "[SQLite] invalid synchronous mode: '" << m_Settings.m_Synchronous << "'" << std::endl;
+
+    ss << "PRAGMA cache_size = " << m_Settings.m_CacheSize << ";\n";
+    ss << "PRAGMA mmap_size = " << m_Settings.m_MmapSize << ";\n";
+
+    m_Writer.m_pDatabase->exec(ss.str());
+}
+
+void CSQLiteRankingServer::BeginWrite()
+{
+    HandleRolledBackTransaction();
+
+    if (m_Settings.m_GroupCommitIntervalMs <= 0 || m_InTransaction)
+        return;
+
+    // IMMEDIATE takes the write lock right away instead of failing on the first write
+    m_Writer.m_pDatabase->exec("BEGIN IMMEDIATE;");
+    m_InTransaction = true;
+    m_TransactionStart = std::chrono::steady_clock::now();
+    m_TransactionWrites = 0;
+    m_TransactionLog.clear();
+}
+
+void CSQLiteRankingServer::LogWrite(const std::string& action, const std::string& nickname, const CPlayerStats& stats, const std::string& prefix)
+{
+    if (m_InTransaction)
+        m_TransactionLog.emplace_back(action, nickname, stats, prefix);
+}
+
+void CSQLiteRankingServer::EndWrite(size_t numWrites)
+{
+    if (!m_InTransaction)
+        return;
+
+    m_TransactionWrites += numWrites;
+
+    if (std::chrono::steady_clock::now() - m_TransactionStart >= std::chrono::milliseconds(m_Settings.m_GroupCommitIntervalMs))
+        CommitWrites();
+}
+
+bool CSQLiteRankingServer::CommitWrites()
+{
+    if (!m_InTransaction)
+        return true;
+    else if (HandleRolledBackTransaction())
+        return false;
+
+    m_InTransaction = false;
+    m_TransactionWrites = 0;
+    try
+    {
+        m_Writer.m_pDatabase->exec("COMMIT;");
+        m_TransactionLog.clear();
+        return true;
+    }
+    catch (const SQLite::Exception& e)
+    {
+        std::cout << "[SQLite] failed to commit " << m_TransactionLog.size() << " grouped writes, adding them to the backlog: " << e.what() << std::endl;
+        try
+        {
+            m_Writer.m_pDatabase->exec("ROLLBACK;");
+        }
+        catch (const SQLite::Exception& e)
+        {
+            // transaction has already been rolled back by SQLite
+        }
+    }
+
+    RestoreTransactionLog();
+    return false;
+}
+
+bool CSQLiteRankingServer::HandleRolledBackTransaction()
+{
+    // the connection is back in autocommit mode, if SQLite has rolled back the transaction.
+    if (!m_InTransaction || sqlite3_get_autocommit(m_Writer.m_pDatabase->getHandle()) == 0)
+        return false;
+
+    std::cout << "[SQLite] the group transaction has been rolled back, adding its " << m_TransactionLog.size() << " writes to the backlog" << std::endl;
+    m_InTransaction = false;
+    m_TransactionWrites = 0;
+    RestoreTransactionLog();
+    return true;
+}
+
+void CSQLiteRankingServer::RestoreTransactionLog()
+{
+    // the writers have already reported success, the writes are replayed in their order.
+    for (auto& [action, nickname, stats, prefix] : m_TransactionLog)
+    {
+        m_Backlog.Add(action, nickname, stats, prefix);
+    }
+    m_TransactionLog.clear();
+    m_FailedCommits++;
+
+    // the caches contain the rolled back writes.
+    m_RankingCache.Clear();
+    m_LeaderboardCache.Clear();
+}
+
+void CSQLiteRankingServer::HandleGroupCommit()
+{
+    std::chrono::milliseconds interval{m_Settings.m_GroupCommitIntervalMs};
+
+    std::unique_lock<std::mutex> lock(m_GroupCommitMutex);
+    while (!m_StopGroupCommit)
+    {
+        m_GroupCommitCondition.wait_for(lock, interval);
+
+        // writes commit by themselves, as long as new ones arrive,
+        // this commits the last window after the writes stopped.
+        bool committed = false;
+        {
+            std::lock_guard<std::mutex> databaseLock(m_DatabaseMutex);
+            if (m_InTransaction && std::chrono::steady_clock::now() - m_TransactionStart >= interval)
+                committed = CommitWrites();
+        }
+
+        if (committed)
+            ReplayBacklogIfDue();
+    }
+}
+
+bool CSQLiteRankingServer::IsValidPrefix(const std::string& prefix)
+{
+    std::lock_guard<std::mutex> lock(m_ValidPrefixListMutex);
+
     for (auto& p : m_ValidPrefixList)
     {
-        // create table for every prefix
-        std::string TableName = p + m_BaseTableName;
+        if (prefix == p)
+            return true;
+    }
+    return false;
+}
 
-        ss << "CREATE TABLE IF NOT EXISTS " << TableName << "  ( ";
-        ss << "Key TEXT PRIMARY KEY ASC,\n";
+std::string CSQLiteRankingServer::GetRankingQuery(const std::string& TableName) const
+{
+    const auto& Columns = CPlayerStats::keys();
+    size_t ColumnsSize = Columns.size();
+
+    // the rank is the number of players that are ranked before the player.
+    // both counts are range scans of the (ranking key, Key) index instead of sorting the whole table,
+    // ties are ordered by nickname like in the top ranking.
+    std::string order = m_BiggestFirst ? " > " : " < ";
+
+    std::stringstream ss;
+
+    ss << "SELECT ";
+    ss << "P.Key as Key , ";
+    ss << "1 + ( SELECT COUNT(*) FROM " << TableName << " WHERE " << m_RankingKey << order << "P." << m_RankingKey << " )"
+       << " + ( SELECT COUNT(*) FROM " << TableName << " WHERE " << m_RankingKey << " = P." << m_RankingKey << " AND Key < P.Key ) as Rank ,";
+
+    for (size_t i = 0; i < ColumnsSize; i++)
+    {
+        ss << " P." << Columns[i] << " as " << Columns[i];
+
+        if (i < ColumnsSize - 1)
+            ss << " ,\n";
+    }
+
+    ss << " FROM " << TableName << " as P"
+       << " WHERE P.Key = ? ;";
+    return ss.str();
+}
+
+std::string CSQLiteRankingServer::GetInsertOrReplaceQuery(const std::string& TableName) const
+{
+    const std::vector<std::string>& Columns = CPlayerStats::keys();
+    size_t ColumnsSize = Columns.size();
+
+    std::stringstream ss;
+
+    ss << "INSERT OR REPLACE INTO " << TableName << " ( ";
+
+    ss << "Key , "; // nickname is the primary key.
+
+    // all columns
+    for (size_t i = 0; i < ColumnsSize; i++)
+    {
+        ss << Columns[i];
+        if (i < ColumnsSize - 1)
+        {
+            ss << " , ";
+        }
+    }
+
+    // for evry column, create a bind variable, to escape possible user input
+    ss << " ) VALUES ( ";
+    ss << "?1 , "; // bind nickname
+
+    for (size_t i = 0; i < ColumnsSize; i++)
+    {
+        ss << "?" << (i + 2);
+        if (i < ColumnsSize - 1)
+        {
+            ss << " , ";
+        }
+    }
+    ss << " );";
+    return ss.str();
+}
+
+std::string CSQLiteRankingServer::GetUpsertQuery(const std::string& TableName) const
+{
+    const std::vector<std::string>& Columns = CPlayerStats::keys();
+    size_t ColumnsSize = Columns.size();
+
+    std::stringstream ss;
+
+    ss << "INSERT INTO " << TableName << " ( ";
+
+    ss << "Key , "; // nickname is the primary key.
+
+    // all columns
+    for (size_t i = 0; i < ColumnsSize; i++)
+    {
+        ss << Columns[i];
+        if (i < ColumnsSize - 1)
+        {
+            ss << " , ";
+        }
+    }
+
+    // for evry column, create a bind variable, to escape possible user input
+    ss << " ) VALUES ( ";
+    ss << "?1 , "; // bind nickname
+
+    for (size_t i = 0; i < ColumnsSize; i++)
+    {
+        ss << "?" << (i + 2);
+        if (i < ColumnsSize - 1)
+        {
+            ss << " , ";
+        }
+    }
+    ss << " )";
 
-        for (size_t i = 0; i < ColumnsSize; i++)
+    // existing players are updated in place, only the changed index entries are touched.
+    ss << " ON CONFLICT(Key) DO UPDATE SET ";
+    for (size_t i = 0; i < ColumnsSize; i++)
+    {
+        ss << Columns[i] << " = " << Columns[i] << " + excluded." << Columns[i];
+        if (i < ColumnsSize - 1)
         {
-            ss << " " << Columns[i] << " UNSIGNED INTEGER DEFAULT 0";
-
-            if (i < ColumnsSize - 1)
-                ss << " ,\n";
+            ss << " , ";
         }
-        ss << " );\n";
+    }
 
-        // create indices
+    // the new total is returned to the leaderboard cache
+    if (sqlite3_libversion_number() >= 3035000)
+    {
+        ss << " RETURNING ";
         for (size_t i = 0; i < ColumnsSize; i++)
         {
-            ss << "CREATE INDEX IF NOT EXISTS " << TableName << "_" << Columns[i] << "_index ON " << TableName << " (" << Columns[i] << ");\n";
+            ss << Columns[i];
+            if (i < ColumnsSize - 1)
+            {
+                ss << " , ";
+            }
         }
     }
+    ss << " ;";
+    return ss.str();
+}
 
-    try
-    {
-        m_FilePath = filePath;
-        m_pDatabase = new SQLite::Database(m_FilePath, SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE);
-        m_pDatabase->setBusyTimeout(busyTimeoutMs);
-        m_pDatabase->exec(ss.str());
+std::string CSQLiteRankingServer::GetDeleteQuery(const std::string& TableName) const
+{
+    std::stringstream ss;
 
-        std::cout << "[SQLite]: Successfully created database: '" << m_FilePath << "'" << std::endl;
-    }
-    catch (const std::exception& e)
-    {
-        std::cout << "[SQLite] failed to create a database: " << e.what() << '\n';
+    ss << "DELETE FROM " << TableName << " WHERE Key = ?;";
+    return ss.str();
+}
 
-        // got an error opening db
-        // no sense in trying again
-        m_DefaultConstructed = true;
+std::string CSQLiteRankingServer::GetTopRankingQuery(const std::string& TableName, const std::string& key, bool biggestFirst) const
+{
+    const auto& Columns = CPlayerStats::keys();
+    size_t ColumnsSize = Columns.size();
+
+    std::stringstream ss;
+
+    ss << "SELECT Key , ";
 
-        if (m_pDatabase)
+    // all columns
+    for (size_t i = 0; i < ColumnsSize; i++)
+    {
+        ss << Columns[i];
+        if (i < ColumnsSize - 1)
         {
-            delete m_pDatabase;
-            m_pDatabase = nullptr;
+            ss << " , ";
         }
     }
+
+    // order by nickname as secondary criterium
+    // the number of players is bound at execution time
+    ss << " FROM " << TableName
+       << " ORDER BY " << key << (biggestFirst ? " DESC " : " ASC ")
+       << ", Key ASC "
+       << " LIMIT ? ;";
+    return ss.str();
 }
 
-CSQLiteRankingServer::~CSQLiteRankingServer()
+SQLite::Statement& CSQLiteRankingServer::GetStatement(CConnection& connection, int operation, const std::string& prefix, const std::string& key, bool biggestFirst)
 {
-    AwaitFutures();
+    statement_key_t statementKey{operation, prefix, key, biggestFirst};
+
+    auto it = connection.m_Statements.find(statementKey);
+    if (it != connection.m_Statements.end())
+    {
+        m_StatementCacheHits++;
+        return *it->second;
+    }
+    m_StatementCacheMisses++;
+
+    std::string TableName = prefix + m_BaseTableName;
+    std::string query;
 
-    if (m_pDatabase)
+    switch (operation)
     {
-        delete m_pDatabase;
-        m_pDatabase = nullptr;
+        case STATEMENT_GET_RANKING:
+            query = GetRankingQuery(TableName);
+            break;
+        case STATEMENT_UPSERT:
+            query = GetUpsertQuery(TableName);
+            break;
+        case STATEMENT_INSERT_OR_REPLACE:
+            query = GetInsertOrReplaceQuery(TableName);
+            break;
+        case STATEMENT_DELETE:
+            query = GetDeleteQuery(TableName);
+            break;
+        case STATEMENT_TOP_RANKING:
+            query = GetTopRankingQuery(TableName, key, biggestFirst);
+            break;
+        default:
+            throw SQLite::Exception("Invalid statement type: " + std::to_string(operation));
     }
+
+    auto [inserted, success] = connection.m_Statements.emplace(statementKey, std::make_unique<SQLite::Statement>(*connection.m_pDatabase, query));
+    return *inserted->second;
 }
 
-bool CSQLiteRankingServer::IsValidPrefix(const std::string& prefix)
+void CSQLiteRankingServer::PrepareStatements(CConnection& connection, const std::string& prefix, bool readOnly)
 {
-    std::lock_guard<std::mutex> lock(m_ValidPrefixListMutex);
+    GetStatement(connection, STATEMENT_GET_RANKING, prefix);
 
-    for (auto& p : m_ValidPrefixList)
+    if (!readOnly)
     {
-        if (prefix == p)
-            return true;
+        GetStatement(connection, STATEMENT_UPSERT, prefix);
+        GetStatement(connection, STATEMENT_INSERT_OR_REPLACE, prefix);
+        GetStatement(connection, STATEMENT_DELETE, prefix);
+    }
+
+    for (auto& key : CPlayerStats::keys())
+    {
+        GetStatement(connection, STATEMENT_TOP_RANKING, prefix, key, true);
+        GetStatement(connection, STATEMENT_TOP_RANKING, prefix, key, false);
     }
-    return false;
 }
 
 CPlayerStats CSQLiteRankingServer::GetRankingSync(std::string nickname, std::string prefix)
@@ -978,358 +3629,735 @@ CPlayerStats CSQLiteRankingServer::GetRankingSync(std::string nickname, std::str
         return stats;
     }
 
-    std::string TableName = prefix + m_BaseTableName;
-    auto Columns = stats.keys();
+    const auto& Columns = CPlayerStats::keys();
+
+    try
+    {
+        CReaderLease reader(*this);
+        SQLite::Statement& stmt = GetStatement(reader.Get(), STATEMENT_GET_RANKING, prefix);
+        CStatementResetGuard guard(stmt);
+
+        // sqlite binding starts counting at 1
+        stmt.bind(1, nickname);
+
+        if (stmt.executeStep())
+        {
+            // get rank column
+            stats.SetRank(stmt.getColumn("Rank").getInt());
+
+            // get all the other in CPlayerStats defined column values
+            for (size_t i = 0; i < Columns.size(); i++)
+            {
+                stats.Get(i) = stmt.getColumn(Columns[i].c_str()).getInt();
+            }
+            return stats;
+        }
+        else
+        {
+            // not found - > returns invalid player stats.
+            stats.Invalidate();
+            return stats;
+        }
+    }
+    catch (const SQLite::Exception& e)
+    {
+        throw;
+    }
+}
+
+void CSQLiteRankingServer::SetRankingSync(std::string nickname, CPlayerStats stats, std::string prefix)
+{
+    FixPrefix(prefix);
+
+    if (!IsValidPrefix(prefix))
+        throw std::invalid_argument("Invalid prefix(not in valid prefix list): " + prefix);
+    else if(!stats.IsValid())
+        throw std::invalid_argument("Invalid player statistics passed.");
+    else if(!IsValidNickname(nickname, prefix))
+        throw std::invalid_argument("Invalid nickname: " + nickname);
+    
+
+    const std::vector<std::string>& Columns = CPlayerStats::keys();
     size_t ColumnsSize = Columns.size();
 
-    std::stringstream ss;
+    BeginWrite();
 
-    ss << "SELECT ";
-    ss << "R.Key as Key , R.Rank as Rank,";
+    try
+    {
+        // bind values to the execution statement
+        SQLite::Statement& stmt = GetStatement(m_Writer, STATEMENT_INSERT_OR_REPLACE, prefix);
+        CStatementResetGuard guard(stmt);
 
-    for (size_t i = 0; i < ColumnsSize; i++)
+        // columns start counting at 1, not at 0.
+        stmt.bind(1, nickname); // primary key
+
+        for (size_t i = 0; i < ColumnsSize; i++)
+        {
+            // column position offset
+            stmt.bind(i + 2, stats.Get(i));
+        }
+
+
+        // execute statement.
+        stmt.exec();
+        LogWrite("set", nickname, stats, prefix);
+        EndWrite();
+    }
+    catch (const SQLite::Exception& e)
     {
-        ss << " R." << Columns[i] << " as " << Columns[i];
+        // the earlier writes of a rolled back transaction are added to the backlog before this one.
+        HandleRolledBackTransaction();
 
-        if (i < ColumnsSize - 1)
-            ss << " ,\n";
+        // throw and add to backlog.
+        throw;
     }
+}
 
-    // order by nickname as secondary criterium
-    ss << " FROM ( "
-       << "SELECT "
-       << "Key , "
-       << "ROW_NUMBER() OVER (ORDER BY " << m_RankingKey << (m_BiggestFirst ? " DESC " : " ASC , Key ASC") << ") Rank ,";
+CPlayerStats CSQLiteRankingServer::UpdateRankingSync(std::string nickname, CPlayerStats stats, std::string prefix)
+{
+    FixPrefix(prefix);
 
-    for (size_t i = 0; i < ColumnsSize; i++)
+    if (!IsValidPrefix(prefix))
+        throw std::invalid_argument("Invalid prefix(not in valid prefix list): " + prefix);
+    else if(!stats.IsValid())
+        throw std::invalid_argument("Invalid player statistics passed.");
+    else if(!IsValidNickname(nickname, prefix))
+        throw std::invalid_argument("Invalid nickname: " + nickname);
+    
+    const std::vector<std::string>& Columns = CPlayerStats::keys();
+    size_t ColumnsSize = Columns.size();
+
+    BeginWrite();
+
+    try
     {
-        ss << " " << Columns[i] << " ";
+        // inserts the player or adds the stats to the saved ones
+        SQLite::Statement& stmt = GetStatement(m_Writer, STATEMENT_UPSERT, prefix);
+        CStatementResetGuard guard(stmt);
 
-        if (i < ColumnsSize - 1)
-            ss << " ,\n";
+        // columns start counting at 1, not at 0.
+        stmt.bind(1, nickname); // primary key
+
+        // bind new values to their respective columns
+        for (size_t i = 0; i < ColumnsSize; i++)
+        {
+            // column position offset
+            stmt.bind(i + 2, stats.Get(i));
+        }
+
+        // update player data.
+        CPlayerStats total = ExecuteUpsert(stmt);
+        LogWrite("update", nickname, stats, prefix);
+        EndWrite();
+        return total;
+    }
+    catch (const SQLite::Exception& e)
+    {
+        HandleRolledBackTransaction();
+        throw;
     }
+}
 
-    ss << " FROM " << TableName << " ) as R"
-       << " WHERE Key = ? ;";
+std::vector<bool> CSQLiteRankingServer::UpdateRankingBatchSync(const IRankingServer::ranking_batch_t& batch, std::vector<CPlayerStats>& totals)
+{
+    return WriteBatch(batch, true, totals);
+}
 
+std::vector<bool> CSQLiteRankingServer::SetRankingBatchSync(const IRankingServer::ranking_batch_t& batch)
+{
+    std::vector<CPlayerStats> totals;
+    return WriteBatch(batch, false, totals);
+}
 
-    
+CPlayerStats CSQLiteRankingServer::ExecuteUpsert(SQLite::Statement& stmt)
+{
+    CPlayerStats total;
+    if (!stmt.executeStep())
+    {
+        total.Invalidate();
+        return total;
+    }
+
+    // RETURNING lists the columns in the order of the fields
+    for (int i = 0; i < CPlayerStats::NUM_FIELDS; i++)
+    {
+        total.Get(i) = stmt.getColumn(i).getInt();
+    }
+    return total;
+}
+
+std::vector<bool> CSQLiteRankingServer::WriteBatch(const IRankingServer::ranking_batch_t& batch, bool addToSavedStats, std::vector<CPlayerStats>& totals)
+{
+    std::vector<bool> status(batch.size(), false);
+    totals.assign(batch.size(), CPlayerStats());
+
+    CPlayerStats tmpStat;
+    const std::vector<std::string>& Columns = CPlayerStats::keys();
+    size_t ColumnsSize = Columns.size();
+
+    // a single transaction for the whole batch,
+    // in group commit mode the batch is part of the group transaction.
+    std::unique_ptr<SQLite::Transaction> pTransaction;
+    if (m_Settings.m_GroupCommitIntervalMs > 0)
+        BeginWrite();
+    else
+        pTransaction = std::make_unique<SQLite::Transaction>(*m_Writer.m_pDatabase);
+
+    for (size_t idx = 0; idx < batch.size(); idx++)
+    {
+        auto [nickname, stats, prefix] = batch[idx];
+        FixPrefix(prefix);
+
+        if (!IsValidPrefix(prefix) || !stats.IsValid() || !IsValidNickname(nickname, prefix))
+        {
+            std::cout << "[SQLite] skipping invalid batch entry: '" << nickname << "', prefix: '" << prefix << "'" << std::endl;
+            continue;
+        }
+
+        try
+        {
+            // the stats are either added to the saved stats or they replace them
+            SQLite::Statement& stmt = GetStatement(m_Writer, addToSavedStats ? STATEMENT_UPSERT : STATEMENT_INSERT_OR_REPLACE, prefix);
+            CStatementResetGuard guard(stmt);
+
+            stmt.bind(1, nickname); // primary key
+            for (size_t i = 0; i < ColumnsSize; i++)
+            {
+                stmt.bind(i + 2, stats.Get(i));
+            }
+
+            if (addToSavedStats)
+            {
+                totals[idx] = ExecuteUpsert(stmt);
+            }
+            else
+            {
+                stmt.exec();
+                totals[idx] = stats;
+            }
+            LogWrite(addToSavedStats ? "update" : "set", nickname, stats, prefix);
+
+            status[idx] = true;
+        }
+        catch (const SQLite::Exception& e)
+        {
+            std::cout << "[SQLite] failed to write batch entry '" << nickname << "': " << e.what() << std::endl;
+
+            // SQLite has rolled back the transaction, the remaining entries need a new one.
+            if (pTransaction && sqlite3_get_autocommit(m_Writer.m_pDatabase->getHandle()) != 0)
+            {
+                // the earlier entries of the batch have been rolled back as well.
+                std::fill(status.begin(), status.begin() + idx, false);
+                for (size_t i = 0; i < idx; i++)
+                {
+                    totals[i].Invalidate();
+                }
+                pTransaction.reset();
+                pTransaction = std::make_unique<SQLite::Transaction>(*m_Writer.m_pDatabase);
+            }
+            else if (!pTransaction && HandleRolledBackTransaction())
+            {
+                BeginWrite();
+            }
+        }
+    }
+
+    if (pTransaction)
+        pTransaction->commit();
+    else
+        EndWrite(batch.size());
+
+    return status;
+}
+
+void CSQLiteRankingServer::DeleteRankingSync(std::string nickname, std::string prefix)
+{
+    FixPrefix(prefix);
+
+    if (!IsValidPrefix(prefix))
+        throw std::invalid_argument("Invalid prefix(not in valid prefix list): " + prefix);
+    else if(!IsValidNickname(nickname, prefix))
+        throw std::invalid_argument("Invalid nickname: " + nickname);
+
+    BeginWrite();
 
     try
     {
-        SQLite::Statement stmt{*m_pDatabase, ss.str()};
+        SQLite::Statement& stmt = GetStatement(m_Writer, STATEMENT_DELETE, prefix);
+        CStatementResetGuard guard(stmt);
 
-        // sqlite binding starts counting at 1
+        // where key = nickname
         stmt.bind(1, nickname);
 
-        if (stmt.executeStep())
+        // delete player data
+        stmt.exec();
+        LogWrite("delete", nickname, CPlayerStats(), prefix);
+        EndWrite();
+    }
+    catch(const SQLite::Exception& e)
+    {
+        HandleRolledBackTransaction();
+        throw;
+    }
+}
+
+IRankingServer::key_stats_vec_t CSQLiteRankingServer::GetTopRankingSync(int topNumber, std::string key, std::string prefix, bool biggestFirst)
+{
+    FixPrefix(prefix);
+
+    if (!IsValidPrefix(prefix))
+        throw SQLite::Exception("Invalid prefix: " + prefix);
+    
+    CPlayerStats tmpStat;
+    const auto& Columns = CPlayerStats::keys();
+
+    try
+    {   
+        IRankingServer::key_stats_vec_t result;
+        std::string tmpName;
+
+
+        CReaderLease reader(*this);
+        SQLite::Statement& stmt = GetStatement(reader.Get(), STATEMENT_TOP_RANKING, prefix, key, biggestFirst);
+        CStatementResetGuard guard(stmt);
+
+        stmt.bind(1, topNumber);
+
+        while (stmt.executeStep())
         {
-            // get rank column
-            stats.SetRank(stmt.getColumn("Rank").getInt());
+            tmpName = stmt.getColumn("Key").getString();            
 
-            // get all the other in CPlayerStats defined column values
-            for (auto& column : Columns)
+            for (size_t i = 0; i < Columns.size(); i++)
             {
-                stats[column] = stmt.getColumn(column.c_str()).getInt();
+                tmpStat.Get(i) = stmt.getColumn(Columns[i].c_str()).getInt();
             }
-            return stats;
-        }
-        else
-        {
-            // not found - > returns invalid player stats.
-            stats.Invalidate();
-            return stats;
+            
+            result.emplace_back(tmpName, tmpStat);
+
+            // reset tmp variables
+            tmpStat.Reset();
+            tmpName = {};
+
         }
+        return result;
     }
-    catch (const SQLite::Exception& e)
+    catch(const SQLite::Exception& e)
     {
         throw;
     }
 }
 
-void CSQLiteRankingServer::SetRankingSync(std::string nickname, CPlayerStats stats, std::string prefix)
+CMemoryRankingServer::CMemoryRankingServer()
 {
-    FixPrefix(prefix);
-
-    if (!IsValidPrefix(prefix))
-        throw SQLite::Exception("Invalid prefix(not in valid prefix list): " + prefix);
-    else if(!stats.IsValid())
-        throw SQLite::Exception("Invalid player statistics passed.");
-    else if(!IsValidNickname(nickname, prefix))
-        throw SQLite::Exception("Invalid nickname: " + nickname);
-    
-
-    std::string TableName = prefix + m_BaseTableName;
-    std::vector<std::string> Columns = stats.keys();
-    size_t ColumnsSize = Columns.size();
+    m_DefaultConstructed = true;
+}
 
-    std::stringstream ss;
+CMemoryRankingServer::CMemoryRankingServer(std::string filePath, std::vector<std::string> validPrefixList, int persistIntervalMs, size_t numWorkers, size_t maxQueuedJobs, CSQLiteSettings settings) : m_PersistIntervalMs{persistIntervalMs}
+{
+    m_DefaultConstructed = false;
 
-    ss << "INSERT OR REPLACE INTO " << TableName << " ( ";
+    SetIndexedKeys(settings.m_IndexedKeys);
 
-    ss << "Key , "; // nickname is the primary key.
+    // the storage keeps the indices of the settings, a database file can also be opened by a CSQLiteRankingServer.
+    for (auto& prefix : validPrefixList)
+    {
+        m_Rankings[NormalizePrefix(prefix)];
+    }
 
-    // all columns
-    for (size_t i = 0; i < ColumnsSize; i++)
+    if (filePath.size() > 0)
     {
-        ss << Columns[i];
-        if (i < ColumnsSize - 1)
+        // reads only happen while loading and a single worker keeps the persisted writes in order.
+        settings.m_NumReaders = 0;
+        m_pStorage = std::make_unique<CSQLiteRankingServer>(filePath, validPrefixList, 10000, 1, 0, settings);
+
+        if (!LoadRankings())
         {
-            ss << " , ";
-        }
-    }
+            std::cout << "[Memory] failed to load the rankings from: '" << filePath << "'" << std::endl;
 
-    // for evry column, create a bind variable, to escape possible user input
-    ss << " ) VALUES ( ";
-    ss << "?1 , "; // bind nickname
+            // persisting would overwrite the database with incomplete rankings.
+            m_DefaultConstructed = true;
+            m_pStorage.reset();
+            return;
+        }
 
-    for (size_t i = 0; i < ColumnsSize; i++)
-    {
-        ss << "?" << (i + 2);
-        if (i < ColumnsSize - 1)
+        if (m_PersistIntervalMs > 0)
         {
-            ss << " , ";
+            m_PersistThread = std::thread(&CMemoryRankingServer::HandlePersistence, this);
         }
     }
-    ss << " );";
 
-    try
-    {
-        // bind values to the execution statement
-        SQLite::Statement stmt{*m_pDatabase, ss.str()};
+    m_WorkerPool.Start(numWorkers, maxQueuedJobs);
+}
 
-        // columns start counting at 1, not at 0.
-        stmt.bind(1, nickname); // primary key
+CMemoryRankingServer::~CMemoryRankingServer()
+{
+    StopWorkers();
 
-        for (size_t i = 0; i < ColumnsSize; i++)
+    if (m_PersistThread.joinable())
+    {
         {
-            // column position offset
-            stmt.bind(i + 2, stats[Columns[i]]);
+            std::lock_guard<std::mutex> lock(m_PersistMutex);
+            m_StopPersisting = true;
         }
-
-
-        // execute statement.
-        stmt.exec();
-    }
-    catch (const SQLite::Exception& e)
-    {
-        // throw and add to backlog.
-        throw;
+        m_PersistCondition.notify_all();
+        m_PersistThread.join();
     }
+
+    // changes since the last interval, the storage finishes its tasks when it is destroyed.
+    Persist();
+    m_pStorage.reset();
 }
 
-void CSQLiteRankingServer::UpdateRankingSync(std::string nickname, CPlayerStats stats, std::string prefix)
+bool CMemoryRankingServer::LoadRankings()
 {
-    FixPrefix(prefix);
-
-    if (!IsValidPrefix(prefix))
-        throw SQLite::Exception("Invalid prefix(not in valid prefix list): " + prefix);
-    else if(!stats.IsValid())
-        throw SQLite::Exception("Invalid player statistics passed.");
-    else if(!IsValidNickname(nickname, prefix))
-        throw SQLite::Exception("Invalid nickname: " + nickname);
-    
-    CPlayerStats savedStats;
-    std::string TableName = prefix + m_BaseTableName;
-    std::vector<std::string> Columns = stats.keys();
-    size_t ColumnsSize = Columns.size();
-
-    std::stringstream ss;
+    size_t numPlayers = 0;
 
-    ss << "SELECT ";
-    ss << "Key ,";
-
-    for (size_t i = 0; i < ColumnsSize; i++)
+    for (auto& [prefix, ranking] : m_Rankings)
     {
-        ss << " " << Columns[i];
+        bool loaded = false;
+        bool started = m_pStorage->GetTopRanking(std::numeric_limits<int>::max(), m_RankingKey, [&, pRanking = &ranking](IRankingServer::key_stats_vec_t& players) {
+            for (auto& [nickname, stats] : players)
+            {
+                auto [it, inserted] = pRanking->m_Players.emplace(nickname, stats);
+                AddToIndices(*pRanking, it->first, it->second);
+            }
+            numPlayers += players.size();
+            loaded = true;
+        }, prefix);
 
-        if (i < ColumnsSize - 1)
-            ss << " ,\n";
+        m_pStorage->AwaitFutures();
+
+        if (!started || !loaded)
+            return false;
     }
 
-    ss << " FROM " << TableName << " WHERE Key = ? ;";
+    std::cout << "[Memory] loaded " << numPlayers << " players from the database." << std::endl;
+    return true;
+}
 
-    try
+void CMemoryRankingServer::HandlePersistence()
+{
+    std::chrono::milliseconds interval{m_PersistIntervalMs};
+
+    std::unique_lock<std::mutex> lock(m_PersistMutex);
+    while (!m_StopPersisting)
     {
-        SQLite::Statement stmt{*m_pDatabase, ss.str()};
+        m_PersistCondition.wait_for(lock, interval);
 
-        // sqlite binding starts counting at 1
-        stmt.bind(1, nickname);
+        if (m_StopPersisting)
+            break;
 
+        Persist();
+    }
+}
 
-        if (stmt.executeStep())
-        {
-            // found player data
+size_t CMemoryRankingServer::Persist()
+{
+    if (!m_pStorage)
+        return 0;
 
-            // get all the other in CPlayerStats defined column values
-            for (auto& column : Columns)
-            {
-                savedStats[column] = stmt.getColumn(column.c_str()).getInt();
-            }        
-        }
-        else
-        {
-            // no data retrieved -> player is not ranked yet.
-        }
+    IRankingServer::ranking_batch_t batch;
+    std::vector<std::pair<std::string, std::string> > deleted;
 
-        // reset stringstream
-        ss.str(std::string());
-        ss.clear();
+    {
+        // only copies the changed players, the database is written by the storage's worker.
+        std::lock_guard<std::mutex> lock(m_DatabaseMutex);
 
-        // update stats
-        if (!savedStats.IsValid())
+        for (auto& [prefix, nickname] : m_DirtyPlayers)
         {
-            // invalid, reset to a valid state
-            savedStats.Reset();
+            CPrefixRanking& ranking = m_Rankings[prefix];
+            auto it = ranking.m_Players.find(nickname);
+
+            if (it != ranking.m_Players.end())
+                batch.emplace_back(nickname, it->second, prefix);
+            else
+                deleted.emplace_back(nickname, prefix);
         }
+        m_DirtyPlayers.clear();
+    }
 
-        // savedStats is either empty or has the needed data stored.
-        savedStats += stats;
+    size_t numPersisted = batch.size() + deleted.size();
 
-        // construct query in order to insert tha updated player data
-        ss << "INSERT OR REPLACE INTO " << TableName << " ( ";
+    // the storage is not thread safe, Persist() might be called by the persistence thread and by the user.
+    std::lock_guard<std::mutex> lock(m_StorageMutex);
 
-        ss << "Key , "; // nickname is the primary key.
+    if (batch.size() > 0)
+        m_pStorage->SetRankingBatch(std::move(batch));
 
-        // all columns
-        for (size_t i = 0; i < ColumnsSize; i++)
-        {
-            ss << Columns[i];
-            if (i < ColumnsSize - 1)
-            {
-                ss << " , ";
-            }
-        }
+    for (auto& [nickname, prefix] : deleted)
+    {
+        m_pStorage->DeleteRanking(nickname, prefix);
+    }
 
-        // for evry column, create a bind variable, to escape possible user input
-        ss << " ) VALUES ( ";
-        ss << "?1 , "; // bind nickname
+    return numPersisted;
+}
 
-        for (size_t i = 0; i < ColumnsSize; i++)
-        {
-            ss << "?" << (i + 2);
-            if (i < ColumnsSize - 1)
-            {
-                ss << " , ";
-            }
-        }
-        ss << " );";
+std::vector<std::string> CMemoryRankingServer::GetKnownPrefixes()
+{
+    // the prefixes are not changed after the construction
+    std::vector<std::string> prefixes;
+    for (auto& [prefix, ranking] : m_Rankings)
+    {
+        prefixes.push_back(prefix);
+    }
+    return prefixes;
+}
 
+std::string CMemoryRankingServer::NormalizePrefix(const std::string& prefix)
+{
+    std::string fixed = prefix;
+    CSQLiteRankingServer::FixPrefix(fixed);
+    return fixed;
+}
 
-        // bind values to the execution statement
-        SQLite::Statement stmt2{*m_pDatabase, ss.str()};
+bool CMemoryRankingServer::IsValidPrefix(const std::string& prefix)
+{
+    // the prefixes are only added by the constructor
+    return FindPrefix(prefix) != nullptr;
+}
 
-        // columns start counting at 1, not at 0.
-        stmt2.bind(1, nickname); // primary key
+CMemoryRankingServer::CPrefixRanking* CMemoryRankingServer::FindPrefix(const std::string& prefix)
+{
+    auto it = m_Rankings.find(prefix);
+    if (it == m_Rankings.end())
+        return nullptr;
 
-        // bind new values to their respective columns
-        for (size_t i = 0; i < ColumnsSize; i++)
-        {
-            // column position offset
-            stmt2.bind(i + 2, savedStats[Columns[i]]);
-        }
+    return &it->second;
+}
 
-        // update player data.
-        stmt2.exec();
+void CMemoryRankingServer::AddToIndices(CPrefixRanking& ranking, const std::string& nickname, CPlayerStats& stats)
+{
+    for (size_t i = 0; i < ranking.m_Indices.size(); i++)
+    {
+        if (m_IndexedFields[i])
+            ranking.m_Indices[i].Insert({stats.Get(i), nickname});
     }
-    catch (const SQLite::Exception& e)
+}
+
+void CMemoryRankingServer::RemoveFromIndices(CPrefixRanking& ranking, const std::string& nickname, CPlayerStats& stats)
+{
+    for (size_t i = 0; i < ranking.m_Indices.size(); i++)
     {
-        throw;
+        if (m_IndexedFields[i])
+            ranking.m_Indices[i].Erase({stats.Get(i), nickname});
     }
 }
 
-void CSQLiteRankingServer::DeleteRankingSync(std::string nickname, std::string prefix)
+size_t CMemoryRankingServer::GetAscendingPosition(const index_t& index, const index_entry_t& entry)
 {
-    FixPrefix(prefix);
+    // the index is sorted biggest value first, nicknames of equal values are sorted ascending.
+    // empty nicknames are invalid, so [value, ""] is the position of the first player with that value.
+    int value = entry.first;
+    size_t groupStart = index.Rank({value, ""});
+    size_t tiesBefore = index.Rank(entry) - groupStart;
+
+    if (value == std::numeric_limits<int>::min())
+        return tiesBefore;
+
+    // everything behind the players with this value is smaller
+    size_t smaller = index.Size() - index.Rank({value - 1, ""});
+    return smaller + tiesBefore;
+}
 
-    if (!IsValidPrefix(prefix))
-        throw SQLite::Exception("Invalid prefix(not in valid prefix list): " + prefix);
-    else if(!IsValidNickname(nickname, prefix))
-        throw SQLite::Exception("Invalid nickname: " + nickname);
+CPlayerStats CMemoryRankingServer::GetRankingSync(std::string nickname, std::string prefix)
+{
+    CPlayerStats stats;
 
-    std::string TableName = prefix + m_BaseTableName;
+    CPrefixRanking* pRanking = FindPrefix(prefix);
+    if (!pRanking || !IsValidNickname(nickname, prefix))
+    {
+        stats.Invalidate();
+        return stats;
+    }
 
-    std::stringstream ss;
+    auto it = pRanking->m_Players.find(nickname);
+    if (it == pRanking->m_Players.end())
+    {
+        stats.Invalidate();
+        return stats;
+    }
 
-    ss << "DELETE FROM " << TableName << " WHERE Key = ?;";
+    stats = it->second;
 
-    try
-    {
-        SQLite::Statement stmt{*m_pDatabase, ss.str()};
+    int field = CPlayerStats::FieldIndex(m_RankingKey);
+    index_entry_t entry{stats.Get(field), nickname};
+    const index_t& index = pRanking->m_Indices[field];
 
-        // where key = nickname
-        stmt.bind(1, nickname);
+    size_t position = m_BiggestFirst ? index.Rank(entry) : GetAscendingPosition(index, entry);
+    stats.SetRank(position + 1);
+    return stats;
+}
 
-        // delete player data
-        stmt.exec();
-    }
-    catch(const SQLite::Exception& e)
+void CMemoryRankingServer::SetRankingSync(std::string nickname, CPlayerStats stats, std::string prefix)
+{
+    CPrefixRanking* pRanking = FindPrefix(prefix);
+    if (!pRanking)
+        throw std::invalid_argument("Invalid prefix(not in valid prefix list): " + prefix);
+    else if (!stats.IsValid())
+        throw std::invalid_argument("Invalid player statistics passed.");
+    else if (!IsValidNickname(nickname, prefix))
+        throw std::invalid_argument("Invalid nickname: " + nickname);
+
+    auto [it, inserted] = pRanking->m_Players.try_emplace(nickname, stats);
+    if (!inserted)
     {
-        throw;
+        RemoveFromIndices(*pRanking, it->first, it->second);
+        it->second = stats;
     }
+    AddToIndices(*pRanking, it->first, it->second);
+
+    m_DirtyPlayers.emplace(prefix, nickname);
 }
 
-IRankingServer::key_stats_vec_t CSQLiteRankingServer::GetTopRankingSync(int topNumber, std::string key, std::string prefix, bool biggestFirst)
+CPlayerStats CMemoryRankingServer::UpdateRankingSync(std::string nickname, CPlayerStats stats, std::string prefix)
 {
-    FixPrefix(prefix);
+    CPrefixRanking* pRanking = FindPrefix(prefix);
+    if (!pRanking)
+        throw std::invalid_argument("Invalid prefix(not in valid prefix list): " + prefix);
+    else if (!stats.IsValid())
+        throw std::invalid_argument("Invalid player statistics passed.");
+    else if (!IsValidNickname(nickname, prefix))
+        throw std::invalid_argument("Invalid nickname: " + nickname);
+
+    auto [it, inserted] = pRanking->m_Players.try_emplace(nickname, stats);
+    if (!inserted)
+    {
+        RemoveFromIndices(*pRanking, it->first, it->second);
+        it->second += stats;
+    }
+    AddToIndices(*pRanking, it->first, it->second);
 
-    if (!IsValidPrefix(prefix))
-        throw SQLite::Exception("Invalid prefix: " + prefix);
-    
-    CPlayerStats tmpStat;
-    auto Columns = tmpStat.keys();
-    size_t ColumnsSize = Columns.size();
+    m_DirtyPlayers.emplace(prefix, nickname);
+    return it->second;
+}
 
-    std::string TableName = prefix + m_BaseTableName;
+std::vector<bool> CMemoryRankingServer::UpdateRankingBatchSync(const IRankingServer::ranking_batch_t& batch, std::vector<CPlayerStats>& totals)
+{
+    std::vector<bool> status(batch.size(), false);
+    totals.assign(batch.size(), CPlayerStats());
 
-    std::stringstream ss;
+    // saved stats and summed up deltas of every player of the batch, one row per player.
+    CPlayerStatsBatch saved;
+    CPlayerStatsBatch deltas;
+    saved.Reserve(batch.size());
+    deltas.Reserve(batch.size());
 
-    ss << "SELECT Key , ";
+    // [ranking, player] of every row, the elements of an unordered_map keep their address.
+    std::vector<std::pair<CPrefixRanking*, std::pair<const std::string, CPlayerStats>*> > rows;
+    std::unordered_map<const CPlayerStats*, size_t> rowOfPlayer;
+    std::vector<size_t> entryRows(batch.size());
 
-    // all columns
-    for (size_t i = 0; i < ColumnsSize; i++)
+    for (size_t idx = 0; idx < batch.size(); idx++)
     {
-        ss << Columns[i];
-        if (i < ColumnsSize - 1)
+        auto& [nickname, stats, prefix] = batch[idx];
+
+        CPrefixRanking* pRanking = FindPrefix(prefix);
+        CPlayerStats delta = stats;
+        if (!pRanking || !delta.IsValid() || !IsValidNickname(nickname, prefix))
         {
-            ss << " , ";
+            std::cout << "[Memory] skipping invalid batch entry: '" << nickname << "', prefix: '" << prefix << "'" << std::endl;
+            totals[idx].Invalidate();
+            continue;
+        }
+
+        // new players start with zeroed stats
+        auto [it, inserted] = pRanking->m_Players.try_emplace(nickname);
+        auto [rowIt, newRow] = rowOfPlayer.try_emplace(&it->second, saved.Size());
+        if (newRow)
+        {
+            if (!inserted)
+                RemoveFromIndices(*pRanking, it->first, it->second);
+
+            saved.Push(it->second);
+            deltas.Push(delta);
+            rows.emplace_back(pRanking, &*it);
+        }
+        else
+        {
+            deltas.Set(rowIt->second, deltas.Get(rowIt->second) += delta);
         }
+        entryRows[idx] = rowIt->second;
+        status[idx] = true;
+        m_DirtyPlayers.emplace(prefix, nickname);
     }
 
-    // order by nickname as secondary criterium
-    ss << " FROM " << TableName 
-    << " ORDER BY " << m_RankingKey << ( biggestFirst ? " DESC " : " ASC ") 
-    << ", Key ASC " 
-    << " LIMIT " << topNumber << ";";
+    saved += deltas;
 
-    try
-    {   
-        IRankingServer::key_stats_vec_t result;
-        std::string tmpName;
+    for (size_t row = 0; row < rows.size(); row++)
+    {
+        auto& [pRanking, pPlayer] = rows[row];
+        pPlayer->second = saved.Get(row);
+        AddToIndices(*pRanking, pPlayer->first, pPlayer->second);
+    }
 
+    // players that appear more than once have their final total at every entry.
+    for (size_t idx = 0; idx < batch.size(); idx++)
+    {
+        if (status[idx])
+            totals[idx] = saved.Get(entryRows[idx]);
+    }
+    return status;
+}
 
-        SQLite::Statement stmt{*m_pDatabase, ss.str()};
+void CMemoryRankingServer::DeleteRankingSync(std::string nickname, std::string prefix)
+{
+    CPrefixRanking* pRanking = FindPrefix(prefix);
+    if (!pRanking)
+        throw std::invalid_argument("Invalid prefix(not in valid prefix list): " + prefix);
+    else if (!IsValidNickname(nickname, prefix))
+        throw std::invalid_argument("Invalid nickname: " + nickname);
+
+    auto it = pRanking->m_Players.find(nickname);
+    if (it == pRanking->m_Players.end())
+        return;
 
-        while (stmt.executeStep())
-        {
-            tmpName = stmt.getColumn("Key").getString();            
+    RemoveFromIndices(*pRanking, it->first, it->second);
+    pRanking->m_Players.erase(it);
 
-            for (auto &column : Columns)
-            {
-                tmpStat[column] = stmt.getColumn(column.c_str()).getInt();
-            }
-            
-            result.emplace_back(tmpName, tmpStat);
+    m_DirtyPlayers.emplace(prefix, nickname);
+}
 
-            // reset tmp variables
-            tmpStat.Reset();
-            tmpName = {};
+IRankingServer::key_stats_vec_t CMemoryRankingServer::GetTopRankingSync(int topNumber, std::string key, std::string prefix, bool biggestFirst)
+{
+    CPrefixRanking* pRanking = FindPrefix(prefix);
+    if (!pRanking)
+        throw std::invalid_argument("Invalid prefix: " + prefix);
 
-        }
+    int field = CPlayerStats::FieldIndex(key);
+    if (field < 0 || !m_IndexedFields[field])
+        throw std::invalid_argument("Invalid key(not indexed): " + key);
+
+    const index_t& index = pRanking->m_Indices[field];
+
+    IRankingServer::key_stats_vec_t result;
+    if (topNumber <= 0)
+        return result;
+
+    size_t count = std::min(static_cast<size_t>(topNumber), index.Size());
+    result.reserve(count);
+
+    auto addPlayer = [&](const index_entry_t& entry) {
+        CPlayerStats stats = pRanking->m_Players[entry.second];
+        stats.SetRank(result.size() + 1);
+        result.emplace_back(entry.second, stats);
+    };
+
+    if (biggestFirst)
+    {
+        index.ForEach(0, count, addPlayer);
         return result;
     }
-    catch(const SQLite::Exception& e)
+
+    // smallest value first: the groups of equal values are visited from the back,
+    // the nicknames within a group are still sorted ascending.
+    size_t end = index.Size();
+    while (result.size() < count)
     {
-        throw;
+        int value = index.At(end - 1).first;
+        size_t groupStart = index.Rank({value, ""});
+
+        index.ForEach(groupStart, std::min(end - groupStart, count - result.size()), addPlayer);
+        end = groupStart;
     }
+    return result;
 }
@@ -1,15 +1,29 @@
 #ifndef GAME_SERVER_RANKINGSERVER_H
 #define GAME_SERVER_RANKINGSERVER_H
 
+#include "backlogjournal.h"
+#include "mpscqueue.h"
+#include "ordertree.h"
 #include "playerstats.h"
+#include "rankingcache.h"
+#include "threadpool.h"
 
 #include <cpp_redis/cpp_redis>
 #include <SQLiteCpp/SQLiteCpp.h>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <functional>
+#include <map>
+#include <memory>
 #include <future>
 #include <mutex>
+#include <set>
 #include <string>
+#include <thread>
 #include <tuple>
+#include <unordered_map>
 #include <vector>
 #include <deque>
 
@@ -25,10 +39,20 @@ class IRankingServer
     // list of [key, stats] pairs
     using key_stats_vec_t = std::vector<std::pair<std::string, CPlayerStats> >;
 
+    // list of [nickname, stats, prefix] entries that are written at once
+    using ranking_batch_t = std::vector<std::tuple<std::string, CPlayerStats, std::string> >;
+
+    // list of [nickname, prefix] entries that are deleted at once
+    using delete_batch_t = std::vector<std::pair<std::string, std::string> >;
+
+    // callback that is called, when a batch has been written.
+    // contains one status per batch entry, true if the entry has been written successfully.
+    using cb_batch_status_t = std::function<void(std::vector<bool>&)>;
+
     // initializes invalid nicknames
     IRankingServer();
 
-    // cleans up futures and waits for them.
+    // waits for all submitted tasks.
     virtual ~IRankingServer();
 
    protected:
@@ -40,6 +64,26 @@ class IRankingServer
     // Synchronizing threads
     std::mutex m_DatabaseMutex;
 
+    // locks that are held while a *Sync function is executed by a worker.
+    // by default reads and writes are serialized by m_DatabaseMutex,
+    // a backend that can read in parallel to its writes returns an empty lock for reading.
+    virtual std::unique_lock<std::mutex> LockForReading();
+    virtual std::unique_lock<std::mutex> LockForWriting();
+
+    // true while there are writes that the read connections cannot see yet, e.g. an open group transaction.
+    // results that are read at such a time are not cached.
+    virtual bool HasUncommittedWrites();
+
+    // true while a part of the data cannot be reached, reads return partial results that are not cached.
+    virtual bool IsDegraded();
+
+    // prefix that the backend stores the rankings under, the public methods and the caches use it.
+    virtual std::string NormalizePrefix(const std::string& prefix);
+
+    // false if the backend cannot store rankings of the(normalized) prefix.
+    // writes of such prefixes are rejected and never added to the backlog.
+    virtual bool IsValidPrefix(const std::string& prefix);
+
 
      // ranking order is based on this key.
     const std::string m_RankingKey{"Score"};
@@ -52,22 +96,116 @@ class IRankingServer
     bool IsValidNickname(const std::string& nickname, const std::string& prefix = "") const;
     bool IsValidKey(const std::string& key) const;
 
+    // fields that have an index(sorted set, table index or in memory tree), all fields by default.
+    // GetTopRanking is only possible for indexed keys, every indexed key is written with every update.
+    std::array<bool, CPlayerStats::NUM_FIELDS> m_IndexedFields;
+
+    // empty -> all keys are indexed, the ranking key is always indexed.
+    // needs to be called by the derived constructor, before the database is set up.
+    // throws std::invalid_argument if a key is not a stats key.
+    void SetIndexedKeys(const std::vector<std::string>& keys);
+
+
+    // number of submitted tasks that have not finished yet, AwaitFutures() waits until it is 0.
+    std::atomic<size_t> m_InFlightJobs{0};
+    std::mutex m_InFlightMutex;
+    std::condition_variable m_InFlightCondition;
+
+    // called once per submitted task, after it has been executed or rejected.
+    void FinishJob();
+
+    // executes the database tasks, needs to be started by the derived class.
+    CThreadPool m_WorkerPool;
+
+    // queues a task in the worker pool and counts it as in flight.
+    // returns false if the job queue is full or the pool has not been started.
+    bool SubmitJob(std::function<void()> job);
+
+    // callbacks of finished tasks that are executed by PollCompletions()
+    std::atomic<bool> m_UseCompletionQueue{false};
+    CMPSCQueue<std::function<void()> > m_Completions;
 
-    // saving futures for later cleanup
-    std::deque<std::future<void> > m_Futures;
+    // calls the callback right away on the worker thread or queues it for PollCompletions().
+    void DispatchCallback(std::function<void()> callback);
 
-    // remove finished futures from vector
-    void CleanupFutures();
+    // awaits all submitted tasks and stops the worker threads.
+    // needs to be called in the derived destructor, before the derived object is destroyed.
+    void StopWorkers();
 
 
+    // coalescing of UpdateRanking calls, disabled if the interval is 0.
+    std::mutex m_PendingUpdatesMutex;
+    // [prefix, nickname] -> sum of all deltas that have not been written yet
+    std::map<std::pair<std::string, std::string>, CPlayerStats> m_PendingUpdates;
+    // number of UpdateRanking calls that have been merged into m_PendingUpdates
+    size_t m_PendingDeltas{0};
+    // total number of deltas that have been flushed
+    std::atomic<size_t> m_MergedDeltas{0};
+
+    // read by the callers of the public methods without holding the mutex.
+    std::atomic<int> m_UpdateFlushIntervalMs{0};
+    std::atomic<size_t> m_UpdateFlushThreshold{64};
+    std::chrono::steady_clock::time_point m_LastUpdateFlush;
+
+    // flushes the pending updates, if the flush interval has passed.
+    void FlushIfDue();
+
+    // flushes the pending updates, when none of the public methods is called for a while.
+    // started by SetUpdateCoalescing(), stopped by StopWorkers().
+    std::thread m_FlushThread;
+    std::mutex m_FlushMutex;
+    std::condition_variable m_FlushCondition;
+    bool m_StopFlushing{false};
+
+    void HandleFlushTimer();
+    void StopFlushTimer();
+
+    // drops the pending deltas of a player, that are overwritten by a set or delete.
+    void DiscardPendingUpdates(const std::string& nickname, const std::string& prefix);
+
+    // true while deltas of the prefix wait in m_PendingUpdates, the ranks that are read then are not cached.
+    bool HasPendingUpdates(const std::string& prefix);
+
+    // queues the update of a single player
+    bool SubmitUpdate(std::string nickname, CPlayerStats stats, std::string prefix);
+
+    // queues a batch task, action is either "update" or "set"
+    bool SubmitBatch(std::string action, ranking_batch_t batch, cb_batch_status_t callback);
+
+    // GetRanking results, written players are invalidated.
+    CRankingCache m_RankingCache;
+
+    // GetTopRanking results, patched by the write tasks while they hold the write lock.
+    CLeaderboardCache m_LeaderboardCache;
+
     // when we get a disconnect, we safe out db changing actions in a backlog.
-    std::mutex m_BacklogMutex;
-    // action, nickname, stats data, prefix
-    std::vector<std::tuple<std::string, std::string, CPlayerStats, std::string> > m_Backlog;
+    // kept in memory, unless a journal file has been set with SetBacklogJournal().
+    CBacklogJournal m_Backlog;
+
+    // number of backlog entries that are written with a single batch call.
+    size_t m_BacklogReplayBatchSize{512};
 
     // cleanup backlog, when the conection has been established again.
+    // the entries are replayed by a single task, in the order they have been added.
     void CleanupBacklog();
 
+    // the backlog is replayed after a successful write, at most once per interval.
+    // a backend that replays it when its connection is established again disables this.
+    bool m_ReplayBacklogAfterWrites{true};
+    int m_BacklogReplayIntervalMs{1000};
+    std::atomic<int64_t> m_LastBacklogReplayMs{0};
+
+    // called by the write tasks after the database has accepted a write.
+    void ReplayBacklogIfDue();
+
+    // writes the batch while holding the write lock and patches the leaderboards.
+    // returns one status per entry, the caller adds the failed entries to the backlog(SubmitBatch) or restores them(CleanupBacklog).
+    std::vector<bool> WriteBatch(const std::string& action, const ranking_batch_t& batch);
+
+    // deletes the players while holding the write lock and removes them from the leaderboards.
+    // returns one status per entry.
+    std::vector<bool> WriteDeletes(const delete_batch_t& batch);
+
     // ############################################################################################################
     // Interface that needs to be implemented
 
@@ -78,7 +216,8 @@ class IRankingServer
     virtual void SetRankingSync(std::string nickname, CPlayerStats stats, std::string prefix) = 0;
 
     // synchronous execution of ranking update
-    virtual void UpdateRankingSync(std::string nickname, CPlayerStats stats, std::string prefix) = 0;
+    // returns the player's new total, an invalid object if the backend does not know it.
+    virtual CPlayerStats UpdateRankingSync(std::string nickname, CPlayerStats stats, std::string prefix) = 0;
 
     // delete player's ranking synchronously
     virtual void DeleteRankingSync(std::string nickname, std::string prefix) = 0;
@@ -87,15 +226,28 @@ class IRankingServer
     virtual key_stats_vec_t GetTopRankingSync(int topNumber, std::string key, std::string prefix, bool biggestFirst) = 0;
     // ############################################################################################################
 
+    // batch versions of the update, set and delete functions, return one status per entry.
+    // throw an exception if the whole batch failed.
+    // the default implementation executes the single versions one after another.
+    // totals: the new total of every entry's player, like the return value of UpdateRankingSync.
+    virtual std::vector<bool> UpdateRankingBatchSync(const ranking_batch_t& batch, std::vector<CPlayerStats>& totals);
+    virtual std::vector<bool> SetRankingBatchSync(const ranking_batch_t& batch);
+    virtual std::vector<bool> DeleteRankingBatchSync(const delete_batch_t& batch);
+
+    // prefixes that the backend stores rankings of, DeletePlayer() deletes the player's rankings of all of them.
+    // called by the user's thread, needs to return without accessing the database.
+    virtual std::vector<std::string> GetKnownPrefixes() = 0;
+
    public:
     // gets data and does stuff that's defined in callback with it.
     // if no callback is provided, nothing is done.
     // returns true, if async task has been started, false if nick is invalid or if no callback has been provided of if 
     // object has been default-constructed indicating that no connection has been established.
+    // All of the following functions also return false, if the job queue is full.
     bool GetRanking(std::string nickname, std::function<void(CPlayerStats&)> calback = nullptr, std::string prefix = "");
 
 
-    // possible keys CPlayerStats::keys()
+    // possible keys GetIndexedKeys()
     // returns true if an async task has been started successfully, otherwise false
     bool GetTopRanking(int topNumber, std::string key, std::function<void(std::vector<std::pair<std::string, CPlayerStats> >&)> callback = nullptr, std::string prefix = "", bool biggestFirst = true);
 
@@ -112,54 +264,327 @@ class IRankingServer
     bool UpdateRanking(std::string nickname, CPlayerStats stats, std::string prefix = "");
 
 
-    // if prefix is empty, the whole player is deleted.
+    // batch versions of UpdateRanking and SetRanking, e.g. for all players at the end of a round.
+    // all entries are written by a single task, the callback receives the status of every entry.
+    // returns true if an async task has been started successfully,
+    // returns false if none of the entries is valid.
+    bool UpdateRankingBatch(ranking_batch_t batch, cb_batch_status_t callback = nullptr);
+    bool SetRankingBatch(ranking_batch_t batch, cb_batch_status_t callback = nullptr);
+
+
+    // keys that can be used with GetTopRanking
+    bool IsIndexedKey(const std::string& key) const;
+    std::vector<std::string> GetIndexedKeys() const;
+
+
+    // deletes the player's ranking of the prefix, the rankings of other prefixes are kept.
     // returns true if an async task has been started successfulls, 
     // returns false if the provided nickname is invalid.
     bool DeleteRanking(std::string nickname, std::string prefix = "");
 
+    // batch version of DeleteRanking, e.g. for purging cheaters.
+    // all entries are deleted by a single task, the callback receives the status of every entry.
+    // returns true if an async task has been started successfully,
+    // returns false if none of the entries is valid.
+    bool DeleteRankingBatch(delete_batch_t batch, cb_batch_status_t callback = nullptr);
+
+    // deletes the player's rankings of all prefixes, the callback receives one status per prefix.
+    // returns true if an async task has been started successfully,
+    // returns false if the provided nickname is invalid.
+    bool DeletePlayer(std::string nickname, cb_batch_status_t callback = nullptr);
+
+
+    // Merges UpdateRanking calls of the same nickname and prefix in memory and writes them
+    // after flushIntervalMs or as soon as maxPendingPlayers different players have pending updates.
+    // The interval is checked whenever one of the public methods is called and by a timer thread.
+    // flushIntervalMs = 0 disables the coalescing(default).
+    void SetUpdateCoalescing(int flushIntervalMs, size_t maxPendingPlayers = 64);
+
+    // caches up to maxBytes(approximately) of GetRanking results, least recently used results are evicted first.
+    // a write changes the ranks of the other players of its prefix, all cached results of the prefix are retrieved again.
+    // maxAgeMs > 0: results older than this are retrieved again, which is needed if other processes write the database.
+    // maxBytes = 0 disables the cache(default).
+    void SetRankingCache(size_t maxBytes, int maxAgeMs = 0);
+    size_t GetRankingCacheHits() const { return m_RankingCache.GetHits(); };
+    size_t GetRankingCacheMisses() const { return m_RankingCache.GetMisses(); };
+    size_t GetRankingCacheEvictions() const { return m_RankingCache.GetEvictions(); };
+
+    // keeps the top topK players of every requested prefix, key and order in memory.
+    // GetTopRanking requests with topNumber <= topK are served from memory, the lists are patched by the writes.
+    // the backends return the new total of an updated player, which places the player against the last listed one.
+    // ttlMs > 0: lists older than this are retrieved again, e.g. if other processes write the database.
+    // topK = 0 disables the cache(default).
+    void SetLeaderboardCache(size_t topK, int ttlMs = 5000);
+    size_t GetLeaderboardCacheHits() const { return m_LeaderboardCache.GetHits(); };
+    size_t GetLeaderboardCacheMisses() const { return m_LeaderboardCache.GetMisses(); };
+
+    // keeps the backlog of failed writes in an append-only journal file, that is replayed
+    // after a restart. entries of a previous run are replayed right away.
+    // throws std::runtime_error if the file cannot be used.
+    void SetBacklogJournal(const std::string& filePath);
+
+    // number of compacted backlog entries, size of the journal file in bytes(0 if there is none)
+    size_t GetBacklogSize() { return m_Backlog.GetSize(); };
+    size_t GetBacklogBytes() { return m_Backlog.GetFileBytes(); };
+
+    // backlog entries that have been replayed and entries per second of the last replay.
+    size_t GetBacklogReplayedEntries() { return m_Backlog.GetReplayedEntries(); };
+    double GetBacklogReplayRate() { return m_Backlog.GetReplayRate(); };
+
+    // enabled: the callbacks of GetRanking, GetTopRanking and the batch functions are not called
+    // by the worker threads anymore, they are queued and called by PollCompletions() instead.
+    // disabled(default): the callbacks are called by the worker that executed the task.
+    void SetCompletionQueue(bool enabled);
+
+    // calls at most maxItems queued callbacks(0 = all) on the calling thread, e.g. once per game tick.
+    // only one thread may poll at a time. returns the number of callbacks that have been called.
+    size_t PollCompletions(size_t maxItems = 0);
+    size_t GetPendingCompletions() const { return m_Completions.Size(); };
+
+    // starts the async execution of all pending updates.
+    // returns the number of UpdateRanking deltas that have been merged into the started tasks.
+    size_t Flush();
+
+    // total number of UpdateRanking deltas that have been flushed.
+    size_t GetMergedDeltas() const { return m_MergedDeltas; };
 
     // This functions can, but should not necessarily be used.
     // It can be used to synchronize execution.
-    // wait for all futures to finish execution(used in destructor)
+    // flushes pending updates and waits for all submitted tasks to finish execution(used in destructor)
     void AwaitFutures();
+
+    // maximum number of tasks that have been waiting in the job queue at the same time.
+    size_t GetQueueHighWaterMark() const { return m_WorkerPool.GetQueueHighWaterMark(); };
+
+    // number of tasks that have not been started, because the job queue was full.
+    size_t GetRejectedJobs() const { return m_WorkerPool.GetRejectedJobs(); };
 };
 
 class CRedisRankingServer : public IRankingServer
 {
    private:
 
-    // redis server host & port
-    std::string m_Host;
-    size_t m_Port;
+    // pooled connection, used by one job at a time.
+    struct CConnection
+    {
+        cpp_redis::client m_Client;
+        std::mutex m_Mutex;
+
+        // jobs that use the connection or wait for it
+        std::atomic<size_t> m_InFlight{0};
+        std::atomic<size_t> m_MaxInFlight{0};
+    };
+
+    // redis server that stores the players of its part of the hash ring.
+    struct CShard
+    {
+        // redis server host & port
+        std::string m_Host;
+        size_t m_Port{0};
+
+        // every job sends its commands with a single sync_commit on its own connection,
+        // jobs on different connections have their round trips in flight at the same time.
+        std::vector<std::unique_ptr<CConnection> > m_Connections;
+
+        // every shard reconnects on its own, the other shards keep working.
+        std::mutex m_ReconnectHandlerMutex;
+        bool m_IsReconnectHandlerRunning{false};
+        std::future<void> m_ReconnectFuture;
+    };
+
+    std::vector<std::unique_ptr<CShard> > m_Shards;
+
+    // consistent hash ring, token -> shard index.
+    // adding a shard only moves the players of the ring segments that the new shard takes over.
+    static const int ms_ShardTokens;
+    std::map<uint64_t, size_t> m_Ring;
+
+    // sorted endpoints of the ring, every shard stores the ring that it has been written with.
+    // a shard of a different ring has players that this ring puts on other shards, it is not used.
+    static const std::string ms_RingKey;
+    std::string m_RingSignature;
+
+    // stores the ring in the shard if it has none yet.
+    // throws std::invalid_argument if the shard stores a different ring,
+    // cpp_redis::redis_error if the shard cannot be reached.
+    void CheckRing(CShard& shard);
+
+    // shard that stores the player of the prefix
+    size_t GetShardIndex(const std::string& nickname, const std::string& prefix) const;
+    CShard& GetShard(const std::string& nickname, const std::string& prefix) { return *m_Shards[GetShardIndex(nickname, prefix)]; };
+
+    // leases the connection of the shard with the fewest jobs for its lifetime.
+    class CConnectionLease
+    {
+        CConnection* m_pConnection;
+        std::unique_lock<std::mutex> m_Lock;
+
+       public:
+        CConnectionLease(CShard& shard);
+        ~CConnectionLease();
+        cpp_redis::client& Get() { return m_pConnection->m_Client; };
+    };
+
+    // leases a connection of every used shard, in the order of the shards.
+    // jobs that need several shards lock them in the same order and cannot deadlock.
+    class CShardLeases
+    {
+        std::vector<std::unique_ptr<CConnectionLease> > m_Leases;
+
+       public:
+        CShardLeases(CRedisRankingServer& server, const std::vector<bool>& usedShards);
+        bool IsLeased(size_t shard) const { return m_Leases[shard] != nullptr; };
+        cpp_redis::client& Get(size_t shard) { return m_Leases[shard]->Get(); };
+    };
+
+    // true if all connections of the shard are established
+    static bool IsConnected(CShard& shard);
+
+    // true if the shard is connected and its connections are not used by the reconnect handler.
+    // reads skip the shards that are not available instead of waiting for them.
+    static bool IsAvailable(CShard& shard);
+
+    // starts the reconnect handler of every leased shard that has lost its connection.
+    void HandleConnectionErrors(CShardLeases& leases, const cpp_redis::redis_error& e);
+
+    // sends the pipelines of the used shards, they are executed at the same time.
+    // shards that cannot be reached are marked as failed.
+    void CommitShards(CShardLeases& leases, const std::vector<bool>& usedShards, std::vector<bool>& failedShards);
 
-    // redis client
-    cpp_redis::client m_Client;
-
-    
-    std::mutex m_ReconnectHandlerMutex;
-    bool m_IsReconnectHandlerRunning;
-    
     int m_ReconnectIntervalMilliseconds;
-    void HandleReconnecting();
-    void StartReconnectHandler();
+    void HandleReconnecting(CShard& shard);
+    void StartReconnectHandler(CShard& shard);
+
+    // loads the scripts into the shard, migrates the key layout of all connected shards
+    // and reconciles the indices of the shard, needs to be called after connecting.
+    void PrepareShard(CShard& shard);
+
+    // key layout version 2: the stats of a player are stored in the hash rank:{p<prefix>}:player:<nickname>,
+    // the index of every key in the sorted set rank:{p<prefix>}:idx:<key>.
+    // the hash tag {p<prefix>} puts all keys of a prefix into the same cluster slot.
+    static const std::string ms_KeySpace;
+    static const std::string ms_LayoutVersionKey;
+    static const int ms_LayoutVersion;
+
+    static std::string GetKeyPrefix(const std::string& prefix);
+    static std::string GetPlayerKey(const std::string& nickname, const std::string& prefix);
+
+    // sorted set names in the order of the stats fields, interned for the known prefixes(AddKnownPrefix()).
+    // the names of other prefixes are built into the passed buffer, reads of arbitrary prefixes do not grow the table.
+    CKeyTable m_IndexKeys{[](const std::string& prefix) { return GetKeyPrefix(prefix) + "idx:"; }};
+    const std::vector<std::string>& GetIndexKeys(const std::string& prefix, std::vector<std::string>& buffer) const;
+    const std::string& GetIndexKey(const std::string& prefix, int field, std::string& buffer) const;
+
+    // moves the data of the legacy layout(hash <nickname> with the fields <prefix><key>, sorted sets <prefix><key>)
+    // of the shard to the current layout on the shards of the players, if the shard has not been migrated yet.
+    // the prefixes are found in the fields of the player hashes, only the copied fields are removed.
+    // throws cpp_redis::redis_error if a shard cannot be reached, the migration is retried with the next connection.
+    void MigrateKeyLayout(CShard& source);
+
+    // comma separated keys that the sorted sets of the shard have been built for
+    static const std::string ms_IndexedKeysKey;
+
+    // builds the sorted sets of keys that have not been indexed with the previous connection from the player hashes
+    // and removes the sorted sets of keys that are not indexed anymore, if the indexed keys have changed.
+    // throws cpp_redis::redis_error if the shard cannot be reached, it is retried with the next connection.
+    void ReconcileIndices(CShard& shard);
+
+    // prefixes that have a sorted set of the ranking key on the shard of the client
+    std::vector<std::string> ScanPrefixes(cpp_redis::client& client);
+
+    // prefixes that have been found on the shards or that have been written since, see GetKnownPrefixes().
+    std::mutex m_KnownPrefixesMutex;
+    std::set<std::string> m_KnownPrefixes;
+    void AddKnownPrefix(const std::string& prefix);
+
+    // server side scripts, they are loaded once and executed with EVALSHA
+    static const std::string ms_UpdateScript;
+    static const std::string ms_DeleteScript;
+    static const std::string ms_CopyScript;
+    static const std::string ms_RankScript;
+
+    std::mutex m_ScriptMutex;
+    // script -> sha1 of the loaded script
+    std::map<std::string, std::string> m_ScriptShas;
+
+    // loads all scripts into the script cache of the server, needs to be called after connecting.
+    void LoadScripts(cpp_redis::client& client);
+
+    // queues EVALSHA(or EVAL if the script has not been loaded yet), needs to be committed by the caller.
+    std::future<cpp_redis::reply> EvalScript(cpp_redis::client& client, const std::string& script, const std::vector<std::string>& keys, const std::vector<std::string>& args);
+
+    // script call that has been queued with EvalScript
+    struct CScriptCall
+    {
+        const std::string* m_pScript{nullptr};
+        std::vector<std::string> m_Keys;
+        std::vector<std::string> m_Args;
+        std::future<cpp_redis::reply> m_Future;
+        cpp_redis::reply m_Reply;
+    };
+
+    // queues the call with EvalScript, needs to be committed by the caller.
+    void EvalScript(cpp_redis::client& client, CScriptCall& call);
+
+    // retrieves the replies of calls that have been committed on the same connection.
+    // if the server does not know a script anymore, the scripts are loaded once and
+    // all calls that failed with NOSCRIPT are sent again in a single pipeline.
+    void GetScriptReplies(cpp_redis::client& client, const std::vector<CScriptCall*>& calls);
+
+    // keys and arguments of ms_UpdateScript
+    void GetUpdateScriptArgs(const std::string& nickname, const CPlayerStats& stats, const std::string& prefix, std::vector<std::string>& keys, std::vector<std::string>& args) const;
+
+    // keys and arguments of ms_DeleteScript, deletes all players of the same prefix.
+    void GetDeleteScriptArgs(const std::vector<std::string>& nicknames, const std::string& prefix, std::vector<std::string>& keys, std::vector<std::string>& args) const;
+
+
+    // fills stats with the reply of HMGET <player key> <field names>
+    // returns false and invalidates stats, if the player has no stats
+    static bool ParseStatsReply(const cpp_redis::reply& reply, CPlayerStats& stats);
+
+    // fills total with the new values that the update script returns in the order of GetUpdateScriptArgs().
+    // returns false and invalidates total, if the reply is not a list of all values.
+    bool ParseUpdateReply(const cpp_redis::reply& reply, CPlayerStats& total) const;
 
    protected:    
 
+    // reads are not serialized, writes still are.
+    virtual std::unique_lock<std::mutex> LockForReading();
+
+    // true while a shard is not available
+    virtual bool IsDegraded();
+
     // retrieve player data syncronously
+    // with several shards, the rank counts the players of the other shards that are available
+    // and that are in front of the player in the top ranking, equal scores are ordered by nickname.
+    // throws cpp_redis::redis_error if the player's shard is not available.
     virtual CPlayerStats GetRankingSync(std::string nickname, std::string prefix = "");
 
     // set specific values
     virtual void SetRankingSync(std::string nickname, CPlayerStats stats, std::string prefix = "");
 
     // synchronous execution of ranking update
-    virtual void UpdateRankingSync(std::string nickname, CPlayerStats stats, std::string prefix = "");
+    virtual CPlayerStats UpdateRankingSync(std::string nickname, CPlayerStats stats, std::string prefix = "");
 
-    // delete player's ranking
+    // delete player's ranking, the hash and its index entries are deleted atomically by the delete script.
     virtual void DeleteRankingSync(std::string nickname, std::string prefix = "");
 
     // retrieve top x player ranks based on their key property(like score, kills etc.).
+    // the top x of every shard are retrieved at the same time and merged,
+    // shards that are not available are skipped.
     virtual IRankingServer::key_stats_vec_t GetTopRankingSync(int topNumber, std::string key, std::string prefix = "", bool biggestFirst = true);
 
+    // the entries of every shard are sent in one pipeline, the shards are written at the same time.
+    // updates are executed by the update script, sets in one MULTI/EXEC transaction per prefix,
+    // deletes by one delete script call per prefix.
+    // the entries of an unreachable shard fail, the other shards are not affected.
+    virtual std::vector<bool> UpdateRankingBatchSync(const IRankingServer::ranking_batch_t& batch, std::vector<CPlayerStats>& totals);
+    virtual std::vector<bool> SetRankingBatchSync(const IRankingServer::ranking_batch_t& batch);
+    virtual std::vector<bool> DeleteRankingBatchSync(const IRankingServer::delete_batch_t& batch);
+
+    // prefixes that have been found on the shards or that have been written since
+    virtual std::vector<std::string> GetKnownPrefixes();
+
    public:
 
     // default constructor - prevents the creation of a backlog(especially the allocation of RAM)
@@ -167,19 +592,153 @@ class CRedisRankingServer : public IRankingServer
     CRedisRankingServer();
 
     // constructor
-    CRedisRankingServer(std::string host, size_t port, uint32_t timeout = 10000, uint32_t reconnect_ms = 5000);
+    // numWorkers threads execute the queued tasks, at most maxQueuedJobs tasks can wait for execution(0 = unlimited).
+    // numConnections clients are connected to the server, 0 = one per worker.
+    // only the indexedKeys have a sorted set, that is updated with every write(empty = all keys).
+    CRedisRankingServer(std::string host, size_t port, uint32_t timeout = 10000, uint32_t reconnect_ms = 5000, size_t numWorkers = 2, size_t maxQueuedJobs = 4096, size_t numConnections = 0, std::vector<std::string> indexedKeys = {});
+
+    // the players are distributed over the "host:port" endpoints with a consistent hash ring,
+    // numConnections clients are connected to every endpoint.
+    // throws std::invalid_argument if an endpoint is invalid or given twice,
+    // or if a connected endpoint has been used with a different list of endpoints.
+    CRedisRankingServer(std::vector<std::string> endpoints, uint32_t timeout = 10000, uint32_t reconnect_ms = 5000, size_t numWorkers = 2, size_t maxQueuedJobs = 4096, size_t numConnections = 0, std::vector<std::string> indexedKeys = {});
+
+    size_t GetNumShards() const { return m_Shards.size(); };
+
+    // number of jobs that currently use or wait for each connection, the connections of the shards in order
+    std::vector<size_t> GetConnectionDepths() const;
+
+    // maximum number of jobs that used or waited for each connection at the same time
+    std::vector<size_t> GetMaxConnectionDepths() const;
     
     // clean up internal stuff and wait for internal asyncronous tasks to finish.
     // might take as much time as the reconnect_ms(see the constructor parameter) to finish its tasks.
     virtual ~CRedisRankingServer();
 };
 
+// database settings of the CSQLiteRankingServer
+struct CSQLiteSettings
+{
+    // PRAGMA journal_mode, WAL allows reading while writing and does not sync on every commit.
+    std::string m_JournalMode{"WAL"};
+
+    // PRAGMA synchronous, NORMAL is safe in WAL mode.
+    std::string m_Synchronous{"NORMAL"};
+
+    // PRAGMA cache_size, negative values are KiB, positive values are pages.
+    int m_CacheSize{-8192};
+
+    // PRAGMA mmap_size in bytes, 0 disables memory mapped I/O.
+    int64_t m_MmapSize{0};
+
+    // if > 0, all writes of this time window are committed in one transaction(group commit).
+    // a crash loses the writes of the current window.
+    int m_GroupCommitIntervalMs{0};
+
+    // number of read only connections for GetRanking and GetTopRanking, only used in WAL mode.
+    // readers do not block the writer, but they do not see the writes of an open group commit transaction.
+    // 0 -> all requests use the writer connection.
+    size_t m_NumReaders{2};
+
+    // keys that have an index and can be used with GetTopRanking, empty = all keys.
+    // indices of other keys are dropped from existing databases, which saves a write per key and player.
+    std::vector<std::string> m_IndexedKeys;
+};
+
 class CSQLiteRankingServer : public IRankingServer
 {
    private:
     std::string m_FilePath;
 
-    SQLite::Database *m_pDatabase;
+    // cached statement types
+    enum
+    {
+        STATEMENT_GET_RANKING = 0,
+        STATEMENT_UPSERT,
+        STATEMENT_INSERT_OR_REPLACE,
+        STATEMENT_DELETE,
+        STATEMENT_TOP_RANKING,
+    };
+
+    // statement type, table prefix, sort key, biggest first
+    using statement_key_t = std::tuple<int, std::string, std::string, bool>;
+
+    // database connection with its prepared statements, they are reused with reset().
+    struct CConnection
+    {
+        SQLite::Database *m_pDatabase{nullptr};
+        std::map<statement_key_t, std::unique_ptr<SQLite::Statement> > m_Statements;
+    };
+
+    // all writes use this connection, it is guarded by the database mutex.
+    CConnection m_Writer;
+
+    // read only connections, a reader is used by one job at a time.
+    std::vector<std::unique_ptr<CConnection> > m_Readers;
+    std::vector<CConnection*> m_FreeReaders;
+    std::mutex m_ReadersMutex;
+    std::condition_variable m_ReadersCondition;
+
+    // leases a free reader connection for its lifetime.
+    // without readers, the writer connection is used and the database mutex is locked.
+    class CReaderLease
+    {
+        CSQLiteRankingServer& m_Server;
+        CConnection* m_pConnection;
+        std::unique_lock<std::mutex> m_WriterLock;
+
+       public:
+        CReaderLease(CSQLiteRankingServer& server);
+        ~CReaderLease();
+        CConnection& Get() { return *m_pConnection; };
+    };
+
+    void OpenReaders(int busyTimeoutMs);
+    void CloseReaders();
+
+    CSQLiteSettings m_Settings;
+
+    // group commit: the transaction that is kept open for the current time window.
+    // read without the database mutex by HasUncommittedWrites().
+    std::atomic<bool> m_InTransaction{false};
+    std::chrono::steady_clock::time_point m_TransactionStart;
+    size_t m_TransactionWrites{0};
+
+    // [action, nickname, stats, prefix] of the writes of the open transaction,
+    // they are added to the backlog if the transaction cannot be committed.
+    std::vector<std::tuple<std::string, std::string, CPlayerStats, std::string> > m_TransactionLog;
+    std::atomic<size_t> m_FailedCommits{0};
+
+    // called after a write has been executed, before EndWrite().
+    void LogWrite(const std::string& action, const std::string& nickname, const CPlayerStats& stats, const std::string& prefix);
+
+    // commits the open transaction after every interval.
+    std::thread m_GroupCommitThread;
+    std::mutex m_GroupCommitMutex;
+    std::condition_variable m_GroupCommitCondition;
+    bool m_StopGroupCommit{false};
+    void HandleGroupCommit();
+
+    // needs to be called before and after every write, while the database mutex is locked.
+    // in group commit mode, a transaction is started if none is open
+    // and it is committed, when the time window has passed.
+    void BeginWrite();
+    void EndWrite(size_t numWrites = 1);
+
+    // commits the open transaction(if any), the database mutex needs to be locked.
+    // returns false if the transaction has been rolled back, its writes are added to the backlog then.
+    bool CommitWrites();
+
+    // SQLite rolls back the whole transaction by itself on some errors(SQLITE_FULL, SQLITE_IOERR, SQLITE_BUSY...),
+    // following writes would be autocommitted and replayed a second time.
+    // adds the logged writes to the backlog and returns true, if the open transaction has been rolled back.
+    bool HandleRolledBackTransaction();
+
+    // adds the logged writes of a rolled back transaction to the backlog.
+    void RestoreTransactionLog();
+
+    // applies the pragmas of the settings to the database
+    void ApplySettings();
 
     std::mutex m_ValidPrefixListMutex;
     std::vector<std::string> m_ValidPrefixList;
@@ -187,9 +746,31 @@ class CSQLiteRankingServer : public IRankingServer
     // table base name, that's added after the table prefix
     const std::string m_BaseTableName{"Ranking"};
 
-   
-    bool IsValidPrefix(const std::string& prefix);
-    void FixPrefix(std::string& prefix);
+
+    std::atomic<size_t> m_StatementCacheHits{0};
+    std::atomic<size_t> m_StatementCacheMisses{0};
+
+    // returns the cached statement, prepares it if it has not been cached yet.
+    // the statement needs to be reset after its execution(see CStatementResetGuard).
+    SQLite::Statement& GetStatement(CConnection& connection, int operation, const std::string& prefix, const std::string& key = "", bool biggestFirst = true);
+
+    // prepares all statements of a table prefix, readers only need the read statements.
+    void PrepareStatements(CConnection& connection, const std::string& prefix, bool readOnly = false);
+
+    std::string GetRankingQuery(const std::string& TableName) const;
+    std::string GetInsertOrReplaceQuery(const std::string& TableName) const;
+    std::string GetUpsertQuery(const std::string& TableName) const;
+    std::string GetDeleteQuery(const std::string& TableName) const;
+    std::string GetTopRankingQuery(const std::string& TableName, const std::string& key, bool biggestFirst) const;
+
+    // writes all entries in a single transaction.
+    // addToSavedStats = true: the entries are added to the saved stats, otherwise they replace them.
+    // totals: the saved stats of every entry's player after the write.
+    std::vector<bool> WriteBatch(const IRankingServer::ranking_batch_t& batch, bool addToSavedStats, std::vector<CPlayerStats>& totals);
+
+    // executes the bound upsert, returns the player's new total(RETURNING, SQLite 3.35+).
+    // the total is invalid if the SQLite library does not support RETURNING.
+    static CPlayerStats ExecuteUpsert(SQLite::Statement& stmt);
 
    protected:
     // retrieve player data syncronously
@@ -199,7 +780,7 @@ class CSQLiteRankingServer : public IRankingServer
     virtual void SetRankingSync(std::string nickname, CPlayerStats stats, std::string prefix = "");
 
     // synchronous execution of ranking update
-    virtual void UpdateRankingSync(std::string nickname, CPlayerStats stats, std::string prefix = "");
+    virtual CPlayerStats UpdateRankingSync(std::string nickname, CPlayerStats stats, std::string prefix = "");
 
     // delete player's ranking
     virtual void DeleteRankingSync(std::string nickname, std::string prefix = "");
@@ -207,14 +788,147 @@ class CSQLiteRankingServer : public IRankingServer
     // retrieve top x player ranks based on their key property(like score, kills etc.).
     virtual IRankingServer::key_stats_vec_t GetTopRankingSync(int topNumber, std::string key, std::string prefix = "", bool biggestFirst = true);
 
+    // one transaction per batch with statements that are reused for all entries
+    virtual std::vector<bool> UpdateRankingBatchSync(const IRankingServer::ranking_batch_t& batch, std::vector<CPlayerStats>& totals);
+    virtual std::vector<bool> SetRankingBatchSync(const IRankingServer::ranking_batch_t& batch);
+
+    // prefixes of the constructor, they are table prefixes
+    virtual std::vector<std::string> GetKnownPrefixes();
+
+    // reads lease their own connection, only writes are serialized by the database mutex.
+    virtual std::unique_lock<std::mutex> LockForReading();
+
+    // the readers do not see the writes of the open group transaction.
+    virtual bool HasUncommittedWrites();
+
+    // table prefixes cannot contain whitespace or start with a digit, see FixPrefix().
+    virtual std::string NormalizePrefix(const std::string& prefix);
+
+    // only the prefixes of the constructor have tables
+    virtual bool IsValidPrefix(const std::string& prefix);
+
    public:
 
     // dummy
     CSQLiteRankingServer();
 
     // all prefixes need to be defined at construction time, in ordr to create the db tables.
-    CSQLiteRankingServer(std::string filePath, std::vector<std::string> validPrefixList = {{""}}, int busyTimeoutMs = 10000);
+    // numWorkers threads execute the queued tasks, at most maxQueuedJobs tasks can wait for execution(0 = unlimited).
+    // settings: journal mode, pragmas and group commit interval of the database.
+    CSQLiteRankingServer(std::string filePath, std::vector<std::string> validPrefixList = {{""}}, int busyTimeoutMs = 10000, size_t numWorkers = 2, size_t maxQueuedJobs = 4096, CSQLiteSettings settings = CSQLiteSettings());
     virtual ~CSQLiteRankingServer();
+
+    // number of statement lookups that could(not) be served by the prepared statement cache
+    size_t GetStatementCacheHits() const { return m_StatementCacheHits; };
+    size_t GetStatementCacheMisses() const { return m_StatementCacheMisses; };
+
+    // number of group transactions that could not be committed, their writes have been added to the backlog.
+    size_t GetFailedCommits() const { return m_FailedCommits; };
+
+    // replaces whitespace and prepends '_' to a leading digit, the result is a valid table prefix.
+    static void FixPrefix(std::string& prefix);
+};
+
+// keeps all rankings in memory and persists them periodically to a SQLite database.
+class CMemoryRankingServer : public IRankingServer
+{
+   private:
+    // [value, nickname] of a player in the index of a key
+    using index_entry_t = std::pair<int, std::string>;
+
+    // biggest value first, ties are ordered by nickname like in the SQLite ranking.
+    struct CIndexOrder
+    {
+        bool operator()(const index_entry_t& lhs, const index_entry_t& rhs) const
+        {
+            if (lhs.first != rhs.first)
+                return lhs.first > rhs.first;
+            return lhs.second < rhs.second;
+        }
+    };
+
+    using index_t = COrderStatisticTree<index_entry_t, CIndexOrder>;
+
+    struct CPrefixRanking
+    {
+        std::unordered_map<std::string, CPlayerStats> m_Players;
+
+        // field of CPlayerStats -> players ordered by their value of that field
+        std::array<index_t, CPlayerStats::NUM_FIELDS> m_Indices;
+    };
+
+    // prefix -> rankings, guarded by the database mutex
+    std::map<std::string, CPrefixRanking> m_Rankings;
+
+    // returns nullptr if the prefix is not in the valid prefix list.
+    CPrefixRanking* FindPrefix(const std::string& prefix);
+
+    void AddToIndices(CPrefixRanking& ranking, const std::string& nickname, CPlayerStats& stats);
+    void RemoveFromIndices(CPrefixRanking& ranking, const std::string& nickname, CPlayerStats& stats);
+
+    // 0-based position of the entry in ascending order(smallest value first)
+    static size_t GetAscendingPosition(const index_t& index, const index_entry_t& entry);
+
+    // database the rankings are loaded from and persisted to, nullptr if nothing is persisted.
+    std::unique_ptr<CSQLiteRankingServer> m_pStorage;
+    std::mutex m_StorageMutex;
+
+    // [prefix, nickname] of the players that changed since the last persistence, guarded by the database mutex.
+    std::set<std::pair<std::string, std::string> > m_DirtyPlayers;
+
+    // persists the dirty players after every interval.
+    int m_PersistIntervalMs{0};
+    std::thread m_PersistThread;
+    std::mutex m_PersistMutex;
+    std::condition_variable m_PersistCondition;
+    bool m_StopPersisting{false};
+    void HandlePersistence();
+
+    // loads all players of all prefixes from the storage.
+    bool LoadRankings();
+
+   protected:
+    // retrieve player data syncronously
+    virtual CPlayerStats GetRankingSync(std::string nickname, std::string prefix = "");
+
+    // set specific values
+    virtual void SetRankingSync(std::string nickname, CPlayerStats stats, std::string prefix = "");
+
+    // synchronous execution of ranking update
+    virtual CPlayerStats UpdateRankingSync(std::string nickname, CPlayerStats stats, std::string prefix = "");
+
+    // delete player's ranking
+    virtual void DeleteRankingSync(std::string nickname, std::string prefix = "");
+
+    // retrieve top x player ranks based on their key property(like score, kills etc.).
+    virtual IRankingServer::key_stats_vec_t GetTopRankingSync(int topNumber, std::string key, std::string prefix = "", bool biggestFirst = true);
+
+    // the stats of the batch are added to the saved stats column by column(CPlayerStatsBatch),
+    // players that appear more than once share a row.
+    virtual std::vector<bool> UpdateRankingBatchSync(const IRankingServer::ranking_batch_t& batch, std::vector<CPlayerStats>& totals);
+
+    // prefixes of the constructor
+    virtual std::vector<std::string> GetKnownPrefixes();
+    virtual bool IsValidPrefix(const std::string& prefix);
+
+    // the same prefixes as the tables of the storage, see CSQLiteRankingServer::FixPrefix().
+    virtual std::string NormalizePrefix(const std::string& prefix);
+
+   public:
+
+    // dummy
+    CMemoryRankingServer();
+
+    // all prefixes need to be defined at construction time, the players of these prefixes are loaded from filePath.
+    // all changed players are written back every persistIntervalMs and when the server is destroyed.
+    // if filePath is empty, nothing is loaded or persisted.
+    // numWorkers threads execute the queued tasks, at most maxQueuedJobs tasks can wait for execution(0 = unlimited).
+    CMemoryRankingServer(std::string filePath, std::vector<std::string> validPrefixList = {{""}}, int persistIntervalMs = 10000, size_t numWorkers = 2, size_t maxQueuedJobs = 4096, CSQLiteSettings settings = CSQLiteSettings());
+    virtual ~CMemoryRankingServer();
+
+    // starts writing all players that changed since the last persistence to the database.
+    // returns the number of players that are written or deleted.
+    size_t Persist();
 };
 
 #endif // GAME_SERVER_RANKINGSERVER_H
\ No newline at end of file
@@ -0,0 +1,201 @@
+#include "backlogjournal.h"
+#include "tests/check.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+namespace
+{
+    std::string ReadFile(const std::string& filePath)
+    {
+        std::ifstream file(filePath, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    void WriteFile(const std::string& filePath, const std::string& content)
+    {
+        std::ofstream file(filePath, std::ios::binary | std::ios::trunc);
+        file.write(content.data(), content.size());
+    }
+
+    // updates are summed up, a set replaces them and a delete is executed before the following action.
+    void TestCompactionAndReopen(const std::string& filePath)
+    {
+        std::remove(filePath.c_str());
+        {
+            CBacklogJournal journal;
+            journal.Open(filePath);
+            journal.Add("update", "a", Score(1), "");
+            journal.Add("set", "b", Score(5), "");
+            journal.Add("update", "a", Score(2), "");
+            journal.Add("delete", "c", CPlayerStats(), "");
+            journal.Add("update", "c", Score(4), "");
+            journal.Add("update", "a", Score(3), "1v1");
+            journal.Add("update", "b", Score(1), "");
+            CHECK(journal.GetSize() == 4);
+        }
+
+        CBacklogJournal journal;
+        journal.Open(filePath);
+        std::vector<CBacklogJournal::CEntry> entries = journal.TakeForReplay();
+        CHECK(entries.size() == 4);
+        if (entries.size() != 4)
+            return;
+
+        CHECK(entries[0].m_Nickname == "a" && entries[0].m_Prefix == "" && entries[0].m_Action == "update" && entries[0].m_Stats.Score() == 3);
+        CHECK(entries[1].m_Nickname == "b" && entries[1].m_Action == "set" && entries[1].m_Stats.Score() == 6);
+        CHECK(entries[2].m_Nickname == "c" && entries[2].m_Delete && entries[2].m_Action == "update" && entries[2].m_Stats.Score() == 4);
+        CHECK(entries[3].m_Nickname == "a" && entries[3].m_Prefix == "1v1" && entries[3].m_Stats.Score() == 3);
+        journal.FinishReplay(entries.size(), 0.0);
+        CHECK(journal.GetSize() == 0);
+    }
+
+    // a crash while appending leaves a partial record behind, the complete records are kept.
+    void TestTornTail(const std::string& filePath)
+    {
+        std::remove(filePath.c_str());
+        size_t completeBytes = 0;
+        {
+            CBacklogJournal journal;
+            journal.Open(filePath);
+            journal.Add("update", "a", Score(1), "");
+            completeBytes = journal.GetFileBytes();
+            journal.Add("update", "b", Score(2), "");
+        }
+
+        std::string content = ReadFile(filePath);
+        CHECK(content.size() > completeBytes + 3);
+        WriteFile(filePath, content.substr(0, content.size() - 3));
+
+        CBacklogJournal journal;
+        journal.Open(filePath);
+        std::vector<CBacklogJournal::CEntry> entries = journal.TakeForReplay();
+        CHECK(entries.size() == 1);
+        CHECK(entries.size() == 1 && entries[0].m_Nickname == "a" && entries[0].m_Stats.Score() == 1);
+        journal.FinishReplay(entries.size(), 0.0);
+
+        // the torn record has been removed from the file.
+        CHECK(ReadFile(filePath).size() == journal.GetFileBytes());
+    }
+
+    // a record with a wrong checksum and everything behind it is dropped.
+    void TestCorruptedRecord(const std::string& filePath)
+    {
+        std::remove(filePath.c_str());
+        {
+            CBacklogJournal journal;
+            journal.Open(filePath);
+            journal.Add("set", "a", Score(7), "");
+            journal.Add("set", "b", Score(8), "");
+        }
+
+        std::string content = ReadFile(filePath);
+        content[content.size() - 1] ^= 0x5A;
+        WriteFile(filePath, content);
+
+        CBacklogJournal journal;
+        journal.Open(filePath);
+        std::vector<CBacklogJournal::CEntry> entries = journal.TakeForReplay();
+        CHECK(entries.size() == 1);
+        CHECK(entries.size() == 1 && entries[0].m_Nickname == "a" && entries[0].m_Stats.Score() == 7);
+        journal.FinishReplay(entries.size(), 0.0);
+    }
+
+    // the file is rewritten with the compacted entries, when it contains many more records.
+    void TestFileCompaction(const std::string& filePath)
+    {
+        std::remove(filePath.c_str());
+
+        CBacklogJournal journal;
+        journal.Open(filePath);
+        size_t emptyBytes = journal.GetFileBytes();
+
+        journal.Add("update", "a", Score(1), "");
+        size_t recordBytes = journal.GetFileBytes() - emptyBytes;
+
+        for (int i = 1; i < 5000; i++)
+        {
+            journal.Add("update", "a", Score(1), "");
+        }
+        CHECK(journal.GetSize() == 1);
+        CHECK(journal.GetFileBytes() < emptyBytes + 2000 * recordBytes);
+        CHECK(ReadFile(filePath).size() == journal.GetFileBytes());
+
+        std::vector<CBacklogJournal::CEntry> entries = journal.TakeForReplay();
+        CHECK(entries.size() == 1 && entries[0].m_Stats.Score() == 5000);
+        journal.FinishReplay(entries.size(), 0.0);
+    }
+
+    // failed entries are replayed again before the entries that have been added during the replay.
+    void TestRestoreOrder(const std::string& filePath)
+    {
+        std::remove(filePath.c_str());
+        {
+            CBacklogJournal journal;
+            journal.Open(filePath);
+            journal.Add("set", "a", Score(1), "");
+            journal.Add("set", "b", Score(2), "");
+
+            std::vector<CBacklogJournal::CEntry> entries = journal.TakeForReplay();
+            CHECK(entries.size() == 2);
+            CHECK(journal.TakeForReplay().empty());
+
+            // added while the replay is running
+            journal.Add("update", "a", Score(3), "");
+            journal.Add("set", "c", Score(4), "");
+
+            // b has been written, a failed
+            if (entries.size() == 2)
+                journal.Restore(entries[0]);
+            journal.FinishReplay(1, 0.0);
+
+            entries = journal.TakeForReplay();
+            CHECK(entries.size() == 3);
+            if (entries.size() == 3)
+            {
+                CHECK(entries[0].m_Nickname == "a" && entries[0].m_Action == "set" && entries[0].m_Stats.Score() == 1);
+                CHECK(entries[1].m_Nickname == "a" && entries[1].m_Action == "update" && entries[1].m_Stats.Score() == 3);
+                CHECK(entries[2].m_Nickname == "c" && entries[2].m_Action == "set" && entries[2].m_Stats.Score() == 4);
+            }
+
+            // none of them has been written
+            for (auto& entry : entries)
+            {
+                journal.Restore(entry);
+            }
+            journal.FinishReplay(0, 0.0);
+        }
+
+        // the restored set and the newer update of a are compacted when the file is loaded.
+        CBacklogJournal journal;
+        journal.Open(filePath);
+        std::vector<CBacklogJournal::CEntry> entries = journal.TakeForReplay();
+        CHECK(entries.size() == 2);
+        if (entries.size() != 2)
+            return;
+
+        CHECK(entries[0].m_Nickname == "a" && entries[0].m_Action == "set" && entries[0].m_Stats.Score() == 4);
+        CHECK(entries[1].m_Nickname == "c" && entries[1].m_Action == "set" && entries[1].m_Stats.Score() == 4);
+        journal.FinishReplay(entries.size(), 0.0);
+    }
+} // namespace
+
+int main()
+{
+    const std::string filePath = "backlogjournal_test.journal";
+
+    TestCompactionAndReopen(filePath);
+    TestTornTail(filePath);
+    TestCorruptedRecord(filePath);
+    TestFileCompaction(filePath);
+    TestRestoreOrder(filePath);
+
+    std::remove(filePath.c_str());
+    std::remove((filePath + ".tmp").c_str());
+
+    return ReportChecks();
+}
@@ -0,0 +1,42 @@
+#ifndef TESTS_CHECK_H
+#define TESTS_CHECK_H
+
+#include "playerstats.h"
+
+#include <iostream>
+
+// counts a failed condition and prints its location, the test continues.
+#define CHECK(condition)                                                                               \
+    do                                                                                                 \
+    {                                                                                                  \
+        if (!(condition))                                                                              \
+        {                                                                                              \
+            std::cout << __FILE__ << ":" << __LINE__ << ": CHECK(" #condition ") failed" << std::endl; \
+            s_Failures++;                                                                              \
+        }                                                                                              \
+    } while (0)
+
+inline int s_Failures = 0;
+
+// stats with only the score set
+inline CPlayerStats Score(int score)
+{
+    CPlayerStats stats;
+    stats.Score() = score;
+    return stats;
+}
+
+// prints the result of all checks, returns the exit code of the test.
+inline int ReportChecks()
+{
+    if (s_Failures > 0)
+    {
+        std::cout << s_Failures << " checks failed." << std::endl;
+        return 1;
+    }
+
+    std::cout << "all checks passed." << std::endl;
+    return 0;
+}
+
+#endif // TESTS_CHECK_H
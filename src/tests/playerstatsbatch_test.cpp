@@ -0,0 +1,124 @@
+#include "playerstatsbatch.h"
+#include "tests/check.h"
+
+#include <climits>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+// the same file is built with the scalar kernel(RANKINGSERVER_SCALAR_BATCH), with SSE2 and with AVX2(RANKINGSERVER_AVX2),
+// every build compares the kernel with CPlayerStats::operator+=.
+namespace
+{
+    // deterministic values of the whole int range, including values that overflow when they are added.
+    class CValueGenerator
+    {
+        uint32_t m_State{12345};
+
+       public:
+        int Next()
+        {
+            m_State = m_State * 1664525u + 1013904223u;
+            switch (m_State % 8)
+            {
+            case 0:
+                return INT_MAX;
+            case 1:
+                return INT_MIN;
+            default:
+                return static_cast<int>(m_State);
+            }
+        }
+
+        CPlayerStats NextStats()
+        {
+            CPlayerStats stats;
+            for (size_t field = 0; field < stats.size(); field++)
+            {
+                stats.Get(field) = Next();
+            }
+            return stats;
+        }
+    };
+
+    bool Equal(const CPlayerStats& lhs, const CPlayerStats& rhs)
+    {
+        for (size_t field = 0; field < lhs.size(); field++)
+        {
+            if (lhs.Get(field) != rhs.Get(field))
+                return false;
+        }
+        return true;
+    }
+
+    // the lengths are not multiples of the 4(SSE2) or 8(AVX2) lanes, the tail is added by the scalar loop.
+    void TestAddMatchesScalar()
+    {
+        CValueGenerator generator;
+        for (size_t size : {0, 1, 3, 4, 5, 7, 8, 9, 15, 17, 31, 33, 100})
+        {
+            std::vector<CPlayerStats> totals;
+            std::vector<CPlayerStats> deltas;
+            for (size_t row = 0; row < size; row++)
+            {
+                totals.push_back(generator.NextStats());
+                deltas.push_back(generator.NextStats());
+            }
+
+            CPlayerStatsBatch batch{totals};
+            batch += CPlayerStatsBatch{deltas};
+            CHECK(batch.Size() == size);
+
+            size_t mismatches = 0;
+            for (size_t row = 0; row < size; row++)
+            {
+                CPlayerStats expected = totals[row];
+                expected += deltas[row];
+                if (!Equal(batch.Get(row), expected))
+                    mismatches++;
+            }
+            CHECK(mismatches == 0);
+        }
+    }
+
+    void TestPushAndSet()
+    {
+        CPlayerStatsBatch batch;
+        CHECK(batch.Push(Score(1)) == 0);
+        CHECK(batch.Push(Score(2)) == 1);
+        batch.Set(0, Score(3));
+        CHECK(batch.Size() == 2);
+        CHECK(batch.Get(0).Score() == 3 && batch.Get(1).Score() == 2);
+
+        // new rows are zeroed
+        batch.Resize(3);
+        CHECK(batch.Get(2).Score() == 0);
+
+        batch.Clear();
+        CHECK(batch.Size() == 0);
+    }
+
+    void TestSizeMismatch()
+    {
+        CPlayerStatsBatch batch(3);
+        bool thrown = false;
+        try
+        {
+            batch += CPlayerStatsBatch(2);
+        }
+        catch (const std::invalid_argument& e)
+        {
+            thrown = true;
+        }
+        CHECK(thrown);
+    }
+} // namespace
+
+int main()
+{
+    TestAddMatchesScalar();
+    TestPushAndSet();
+    TestSizeMismatch();
+
+    return ReportChecks();
+}
@@ -0,0 +1,164 @@
+#include "rankingcache.h"
+#include "tests/check.h"
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+
+namespace
+{
+    void Insert(CRankingCache& cache, const std::string& nickname, const std::string& prefix, int score)
+    {
+        cache.Insert(nickname, prefix, Score(score), cache.GetGeneration(prefix));
+    }
+
+    // every lookup is counted as hit or miss.
+    void TestHitsAndMisses()
+    {
+        CRankingCache cache;
+        cache.Configure(1 << 20);
+
+        CPlayerStats stats;
+        CHECK(!cache.Get("a", "", stats));
+        CHECK(cache.GetMisses() == 1 && cache.GetHits() == 0);
+
+        Insert(cache, "a", "", 7);
+        CHECK(cache.Get("a", "", stats) && stats.Score() == 7);
+        CHECK(cache.Get("a", "", stats));
+        CHECK(cache.GetHits() == 2 && cache.GetMisses() == 1);
+
+        // same nickname, other prefix
+        CHECK(!cache.Get("a", "1v1", stats));
+        CHECK(cache.GetMisses() == 2);
+        CHECK(cache.GetEvictions() == 0);
+    }
+
+    // a write changes the ranks of all players of its prefix, the other prefixes keep their entries.
+    void TestPrefixInvalidation()
+    {
+        CRankingCache cache;
+        cache.Configure(1 << 20);
+
+        Insert(cache, "a", "", 1);
+        Insert(cache, "b", "", 2);
+        Insert(cache, "c", "1v1", 3);
+
+        cache.Invalidate("a", "");
+
+        CPlayerStats stats;
+        CHECK(!cache.Get("a", "", stats));
+        CHECK(!cache.Get("b", "", stats));
+        CHECK(cache.Get("c", "1v1", stats) && stats.Score() == 3);
+        CHECK(cache.GetSize() == 1);
+
+        // a read that started before the write is not inserted
+        uint64_t generation = cache.GetGeneration("");
+        cache.Invalidate("d", "");
+        cache.Insert("b", "", Score(2), generation);
+        CHECK(!cache.Get("b", "", stats));
+
+        // unless the write was for another prefix
+        generation = cache.GetGeneration("");
+        cache.Invalidate("c", "1v1");
+        cache.Insert("b", "", Score(2), generation);
+        CHECK(cache.Get("b", "", stats));
+
+        cache.Clear();
+        CHECK(!cache.Get("b", "", stats));
+        CHECK(cache.GetSize() == 0 && cache.GetUsedBytes() == 0);
+    }
+
+    // the least recently used entries are evicted, when the cache exceeds its memory limit.
+    void TestMemoryLimit()
+    {
+        CRankingCache cache;
+        cache.Configure(1);
+        Insert(cache, "a", "", 1);
+        size_t entryBytes = cache.GetUsedBytes();
+        CHECK(entryBytes > 0);
+
+        const size_t maxBytes = 10 * entryBytes;
+        cache.Configure(maxBytes);
+
+        for (int i = 0; i < 100; i++)
+        {
+            Insert(cache, "p" + std::to_string(i), "", i);
+
+            // p0 is used all the time and stays in the cache
+            CPlayerStats stats;
+            CHECK(cache.Get("p0", "", stats));
+            CHECK(cache.GetUsedBytes() <= maxBytes);
+        }
+
+        CHECK(cache.GetSize() == 10);
+        CHECK(cache.GetEvictions() == 90);
+
+        CPlayerStats stats;
+        CHECK(cache.Get("p99", "", stats) && stats.Score() == 99);
+        CHECK(!cache.Get("p1", "", stats));
+    }
+
+    void TestMaxAge()
+    {
+        CRankingCache cache;
+        cache.Configure(1 << 20, 10);
+
+        Insert(cache, "a", "", 1);
+        CPlayerStats stats;
+        CHECK(cache.Get("a", "", stats));
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        CHECK(!cache.Get("a", "", stats));
+        CHECK(cache.GetSize() == 0);
+    }
+
+    // players that are not listed on an incomplete board are placed with the total of the backend.
+    void TestLeaderboardUpdates()
+    {
+        CLeaderboardCache cache;
+        cache.Configure(2, 0);
+        cache.Store("Score", "", true, {{"a", Score(10)}, {"b", Score(8)}}, cache.GetWriteCount());
+
+        CLeaderboardCache::key_stats_vec_t board;
+        CHECK(cache.Get(2, "Score", "", true, board) && board.size() == 2);
+
+        // c had 5 and passes b
+        cache.OnUpdate("c", Score(4), Score(9), "");
+        CHECK(cache.Get(2, "Score", "", true, board));
+        CHECK(board.size() == 2 && board[0].first == "a" && board[1].first == "c" && board[1].second.Score() == 9);
+
+        // d stays behind the last listed player
+        cache.OnUpdate("d", Score(1), Score(2), "");
+        CHECK(cache.Get(2, "Score", "", true, board));
+        CHECK(board.size() == 2 && board[1].first == "c");
+
+        // without the total, the board might be outdated
+        CPlayerStats unknown;
+        unknown.Invalidate();
+        cache.OnUpdate("e", Score(3), unknown, "");
+        CHECK(!cache.Get(2, "Score", "", true, board));
+    }
+
+    void TestDisabled()
+    {
+        CRankingCache cache;
+        Insert(cache, "a", "", 1);
+
+        CPlayerStats stats;
+        CHECK(!cache.Get("a", "", stats));
+        CHECK(cache.GetSize() == 0);
+    }
+} // namespace
+
+int main()
+{
+    TestHitsAndMisses();
+    TestPrefixInvalidation();
+    TestMemoryLimit();
+    TestMaxAge();
+    TestLeaderboardUpdates();
+    TestDisabled();
+
+    return ReportChecks();
+}
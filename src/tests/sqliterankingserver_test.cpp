@@ -0,0 +1,231 @@
+#include "rankingserver.h"
+#include "tests/check.h"
+
+#include <cstdio>
+#include <future>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+    // calls the synchronous functions directly, without the worker tasks.
+    class CTestServer : public CSQLiteRankingServer
+    {
+       public:
+        CTestServer(const std::string& filePath, CSQLiteSettings settings) : CSQLiteRankingServer(filePath, {""}, 10000, 1, 0, settings)
+        {
+            // the backlog is checked by the tests
+            m_ReplayBacklogAfterWrites = false;
+        }
+
+        using CSQLiteRankingServer::HasUncommittedWrites;
+        using CSQLiteRankingServer::UpdateRankingBatchSync;
+        using CSQLiteRankingServer::UpdateRankingSync;
+    };
+
+    CSQLiteSettings GroupCommitSettings()
+    {
+        CSQLiteSettings settings;
+        settings.m_NumReaders = 0;
+
+        // the transaction stays open during the whole test
+        settings.m_GroupCommitIntervalMs = 60 * 60 * 1000;
+        return settings;
+    }
+
+    // RAISE(ROLLBACK) makes SQLite roll back the whole transaction, like it does on SQLITE_FULL or SQLITE_IOERR.
+    void CreateRollbackTrigger(const std::string& filePath)
+    {
+        SQLite::Database db{filePath, SQLite::OPEN_READWRITE};
+        db.exec("CREATE TRIGGER ForceRollback BEFORE INSERT ON Ranking WHEN NEW.Key = 'rollback' "
+                "BEGIN SELECT RAISE(ROLLBACK, 'forced rollback'); END;");
+    }
+
+    // -1 if the player has not been saved.
+    int SavedScore(const std::string& filePath, const std::string& nickname)
+    {
+        SQLite::Database db{filePath, SQLite::OPEN_READONLY};
+        SQLite::Statement stmt{db, "SELECT Score FROM Ranking WHERE Key = ?;"};
+        stmt.bind(1, nickname);
+        return stmt.executeStep() ? stmt.getColumn(0).getInt() : -1;
+    }
+
+    void RemoveDatabase(const std::string& filePath)
+    {
+        std::remove(filePath.c_str());
+        std::remove((filePath + "-wal").c_str());
+        std::remove((filePath + "-shm").c_str());
+    }
+
+    // the writes of a transaction that SQLite rolled back are added to the backlog once,
+    // the following writes are part of a new transaction instead of being autocommitted.
+    void TestRolledBackGroupTransaction(const std::string& filePath)
+    {
+        RemoveDatabase(filePath);
+        {
+            CTestServer server{filePath, GroupCommitSettings()};
+            CreateRollbackTrigger(filePath);
+
+            server.UpdateRankingSync("a", Score(1));
+            server.UpdateRankingSync("b", Score(2));
+            CHECK(server.HasUncommittedWrites());
+
+            bool failed = false;
+            try
+            {
+                server.UpdateRankingSync("rollback", Score(3));
+            }
+            catch (const SQLite::Exception& e)
+            {
+                failed = true;
+            }
+            CHECK(failed);
+            CHECK(!server.HasUncommittedWrites());
+            CHECK(server.GetFailedCommits() == 1);
+            CHECK(server.GetBacklogSize() == 2);
+
+            server.UpdateRankingSync("c", Score(4));
+            CHECK(server.HasUncommittedWrites());
+
+            // not part of the rolled back transaction
+            CHECK(server.GetBacklogSize() == 2);
+            CHECK(server.GetFailedCommits() == 1);
+        }
+
+        // a and b are only in the backlog, c has been committed with the last transaction.
+        CHECK(SavedScore(filePath, "a") == -1);
+        CHECK(SavedScore(filePath, "b") == -1);
+        CHECK(SavedScore(filePath, "c") == 4);
+    }
+
+    // the entries of a batch behind the failed one are written in a new group transaction.
+    void TestRolledBackBatch(const std::string& filePath)
+    {
+        RemoveDatabase(filePath);
+        {
+            CTestServer server{filePath, GroupCommitSettings()};
+            CreateRollbackTrigger(filePath);
+
+            std::vector<CPlayerStats> totals;
+            std::vector<bool> status = server.UpdateRankingBatchSync({{"a", Score(1), ""}, {"rollback", Score(2), ""}, {"b", Score(3), ""}}, totals);
+            CHECK(status.size() == 3);
+            CHECK(status.size() == 3 && status[0] && !status[1] && status[2]);
+
+            // a has been rolled back and is replayed from the backlog
+            CHECK(server.GetFailedCommits() == 1);
+            CHECK(server.GetBacklogSize() == 1);
+            CHECK(server.HasUncommittedWrites());
+        }
+
+        CHECK(SavedScore(filePath, "a") == -1);
+        CHECK(SavedScore(filePath, "b") == 3);
+    }
+
+    // the upsert returns the player's new total, which places the player on the cached leaderboards.
+    void TestUpdateReturnsTotal(const std::string& filePath)
+    {
+        RemoveDatabase(filePath);
+
+        CSQLiteSettings settings;
+        settings.m_NumReaders = 0;
+        CTestServer server{filePath, settings};
+
+        CPlayerStats total = server.UpdateRankingSync("a", Score(2));
+        CHECK(total.IsValid() && total.Score() == 2);
+
+        total = server.UpdateRankingSync("a", Score(3));
+        CHECK(total.IsValid() && total.Score() == 5);
+
+        std::vector<CPlayerStats> totals;
+        std::vector<bool> status = server.UpdateRankingBatchSync({{"a", Score(1), ""}, {"b", Score(4), ""}, {"a", Score(1), ""}}, totals);
+        CHECK(status.size() == 3 && totals.size() == 3);
+        if (totals.size() != 3)
+            return;
+
+        CHECK(totals[0].Score() == 6);
+        CHECK(totals[1].Score() == 4);
+        CHECK(totals[2].Score() == 7);
+    }
+
+    // writes of prefixes without a table would fail with every replay, they are rejected instead of being backlogged.
+    void TestInvalidPrefix(const std::string& filePath)
+    {
+        RemoveDatabase(filePath);
+
+        CSQLiteSettings settings;
+        settings.m_NumReaders = 0;
+        CTestServer server{filePath, settings};
+
+        CHECK(!server.UpdateRanking("a", Score(1), "unknown"));
+        CHECK(!server.SetRanking("a", Score(1), "unknown"));
+        CHECK(!server.DeleteRanking("a", "unknown"));
+
+        bool rejected = false;
+        try
+        {
+            server.UpdateRankingSync("a", Score(1), "unknown");
+        }
+        catch (const std::invalid_argument& e)
+        {
+            rejected = true;
+        }
+        CHECK(rejected);
+        CHECK(server.GetBacklogSize() == 0);
+    }
+    // waits for the read without AwaitFutures(), which would flush the pending updates.
+    // -1 if the player has not been found.
+    int ReadScore(CTestServer& server, const std::string& nickname)
+    {
+        std::promise<int> score;
+        std::future<int> result = score.get_future();
+        bool submitted = server.GetRanking(nickname, [&score](CPlayerStats& stats) { score.set_value(stats.IsValid() ? stats.Score() : -1); });
+        return submitted ? result.get() : -1;
+    }
+
+    // a rank that is read while an update of the prefix is still being coalesced is outdated after the flush, it is not cached.
+    void TestPendingUpdatesAreNotCached(const std::string& filePath)
+    {
+        RemoveDatabase(filePath);
+
+        CSQLiteSettings settings;
+        settings.m_NumReaders = 0;
+        CTestServer server{filePath, settings};
+        server.SetRankingCache(1 << 20);
+
+        server.SetRanking("a", Score(1));
+        server.AwaitFutures();
+
+        // the interval does not pass during the test, only Flush() writes the pending updates.
+        server.SetUpdateCoalescing(60 * 60 * 1000);
+        CHECK(server.UpdateRanking("b", Score(5)));
+
+        CHECK(ReadScore(server, "a") == 1);
+        CHECK(ReadScore(server, "a") == 1);
+        CHECK(server.GetRankingCacheHits() == 0);
+
+        server.Flush();
+        server.AwaitFutures();
+
+        // no pending updates anymore
+        CHECK(ReadScore(server, "a") == 1);
+        CHECK(ReadScore(server, "a") == 1);
+        CHECK(server.GetRankingCacheHits() == 1);
+    }
+} // namespace
+
+int main()
+{
+    const std::string filePath = "sqliterankingserver_test.db";
+
+    TestRolledBackGroupTransaction(filePath);
+    TestRolledBackBatch(filePath);
+    TestUpdateReturnsTotal(filePath);
+    TestInvalidPrefix(filePath);
+    TestPendingUpdatesAreNotCached(filePath);
+
+    RemoveDatabase(filePath);
+
+    return ReportChecks();
+}
@@ -0,0 +1,109 @@
+#include "threadpool.h"
+
+CThreadPool::CThreadPool() : m_Running{false}, m_MaxQueueSize{0}, m_HighWaterMark{0}, m_RejectedJobs{0}
+{
+}
+
+CThreadPool::~CThreadPool()
+{
+    Shutdown();
+}
+
+void CThreadPool::Start(size_t numThreads, size_t maxQueueSize)
+{
+    std::lock_guard<std::mutex> lock(m_QueueMutex);
+    if (m_Running)
+        return; // already started
+
+    // at least one worker, otherwise nothing would ever be executed
+    if (numThreads == 0)
+        numThreads = 1;
+
+    m_MaxQueueSize = maxQueueSize;
+    m_HighWaterMark = 0;
+    m_RejectedJobs = 0;
+    m_Running = true;
+
+    m_Workers.reserve(numThreads);
+    for (size_t i = 0; i < numThreads; i++)
+    {
+        m_Workers.emplace_back(&CThreadPool::WorkerLoop, this);
+    }
+}
+
+void CThreadPool::Shutdown()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_QueueMutex);
+        if (!m_Running)
+            return;
+
+        m_Running = false;
+    }
+    m_QueueCondition.notify_all();
+
+    // workers leave their loop as soon as the queue is empty.
+    for (auto& worker : m_Workers)
+    {
+        if (worker.joinable())
+            worker.join();
+    }
+    m_Workers.clear();
+}
+
+bool CThreadPool::Submit(CThreadPool::job_t job)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_QueueMutex);
+        if (!m_Running)
+            return false;
+
+        if (m_MaxQueueSize > 0 && m_Queue.size() >= m_MaxQueueSize)
+        {
+            m_RejectedJobs++;
+            return false;
+        }
+
+        m_Queue.push_back(std::move(job));
+
+        if (m_Queue.size() > m_HighWaterMark)
+            m_HighWaterMark = m_Queue.size();
+    }
+
+    m_QueueCondition.notify_one();
+    return true;
+}
+
+bool CThreadPool::IsRunning()
+{
+    std::lock_guard<std::mutex> lock(m_QueueMutex);
+    return m_Running;
+}
+
+size_t CThreadPool::GetQueueSize()
+{
+    std::lock_guard<std::mutex> lock(m_QueueMutex);
+    return m_Queue.size();
+}
+
+void CThreadPool::WorkerLoop()
+{
+    while (true)
+    {
+        job_t job;
+        {
+            std::unique_lock<std::mutex> lock(m_QueueMutex);
+            m_QueueCondition.wait(lock, [this]() { return !m_Running || !m_Queue.empty(); });
+
+            // shutting down and nothing left to do
+            if (m_Queue.empty())
+                return;
+
+            job = std::move(m_Queue.front());
+            m_Queue.pop_front();
+        }
+
+        // jobs are expected to handle their own errors.
+        job();
+    }
+}
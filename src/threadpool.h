@@ -0,0 +1,63 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class CThreadPool
+{
+   public:
+    using job_t = std::function<void()>;
+
+   private:
+    // jobs are pushed by any thread and popped by the workers.
+    std::mutex m_QueueMutex;
+    std::condition_variable m_QueueCondition;
+    std::deque<job_t> m_Queue;
+
+    std::vector<std::thread> m_Workers;
+    bool m_Running;
+
+    // 0 -> unbounded
+    size_t m_MaxQueueSize;
+
+    // largest queue size that has been seen since Start()
+    std::atomic<size_t> m_HighWaterMark;
+
+    // number of jobs that were not accepted because the queue was full
+    std::atomic<size_t> m_RejectedJobs;
+
+    void WorkerLoop();
+
+   public:
+    // does not start any threads, see Start()
+    CThreadPool();
+
+    // finishes all queued jobs and joins the workers.
+    ~CThreadPool();
+
+    // starts numThreads worker threads.
+    // if maxQueueSize is 0, the job queue is not limited.
+    void Start(size_t numThreads, size_t maxQueueSize = 0);
+
+    // stops accepting jobs, waits for the queued jobs to finish and joins all workers.
+    // can be called multiple times.
+    void Shutdown();
+
+    // returns false if the pool is not running or the job queue is full,
+    // in that case the job is not executed.
+    bool Submit(job_t job);
+
+    bool IsRunning();
+    size_t GetNumThreads() const { return m_Workers.size(); };
+    size_t GetQueueSize();
+    size_t GetQueueHighWaterMark() const { return m_HighWaterMark; };
+    size_t GetRejectedJobs() const { return m_RejectedJobs; };
+};
+
+#endif // THREAD_POOL_H